@@ -0,0 +1,1050 @@
+/**
+ * @brief Micro-benchmarks for the sampling and matching paths.
+ *
+ * /proc is replaced by generated fixture trees (see procRoot), so large machines can be
+ * simulated anywhere. Results are printed as one JSON object per line:
+ *   {"benchmark":"getRAM","fixture":"cores=64","iterations":1000,"ns_per_op":123.4}
+ *
+ * The IPC clients are run against stand-in servers speaking the real protocols. Those
+ * double as checks: anything the stand-in didn't see as expected is reported as
+ *   {"benchmark":"DiscordIpcClient","failed":"..."}
+ * and makes the run exit with status 1.
+ *
+ * Usage: bench [filter]   only run benchmarks whose name contains filter
+ *        bench --check    only run the stand-in checks, without timing anything
+ */
+
+#include "../src/header/brpcpp.hpp"
+#include <chrono>
+
+namespace
+{
+    string filter;
+    string fixtureRoot;
+    bool checkOnly = false;
+    int failures = 0;
+
+    // Keep the result of a benchmarked call alive so it can't be optimized out
+    template <typename T>
+    void keep(const T &value)
+    {
+        asm volatile("" : : "g"(&value) : "memory");
+    }
+
+    /**
+     * @brief Time fn until minTime has passed and print the result
+     */
+    void run(const string &name, const string &fixture, function<void()> fn, double minTime = 0.2)
+    {
+        if (checkOnly || (!filter.empty() && name.find(filter) == string::npos))
+        {
+            return;
+        }
+
+        // Warm up caches and persistent fds
+        fn();
+
+        unsigned long iterations = 0;
+        auto start = chrono::steady_clock::now();
+        double elapsed = 0;
+
+        do
+        {
+            for (int i = 0; i < 16; i++)
+            {
+                fn();
+            }
+            iterations += 16;
+            elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        } while (elapsed < minTime);
+
+        printf("{\"benchmark\":\"%s\",\"fixture\":\"%s\",\"iterations\":%lu,\"ns_per_op\":%.1f}\n",
+               name.c_str(), fixture.c_str(), iterations, elapsed * 1e9 / iterations);
+        fflush(stdout);
+    }
+
+    void skip(const string &name, const string &reason)
+    {
+        if (!filter.empty() && name.find(filter) == string::npos)
+        {
+            return;
+        }
+        printf("{\"benchmark\":\"%s\",\"skipped\":\"%s\"}\n", name.c_str(), reason.c_str());
+    }
+
+    /**
+     * @brief Report a stand-in check that didn't pass, the run exits with an error status
+     */
+    void fail(const string &name, const string &reason)
+    {
+        printf("{\"benchmark\":\"%s\",\"failed\":\"%s\"}\n", name.c_str(), reason.c_str());
+        fflush(stdout);
+        failures++;
+    }
+
+    void writeFile(const fs::path &path, const string &content)
+    {
+        ofstream file(path);
+        file << content;
+    }
+
+    /**
+     * @brief A /proc/<pid>/stat line, with the fields the samplers read
+     */
+    string procStat(int pid, const string &comm, int ppid, unsigned long long start)
+    {
+        return to_string(pid) + " (" + comm + ") S " + to_string(ppid) + " " + to_string(pid) + " " + to_string(pid) +
+               " 0 -1 4194304 100 0 0 0 1234 567 0 0 20 0 1 0 " + to_string(start) + " 1000000 2500\n";
+    }
+
+    /**
+     * @brief Generate a fake procfs with the given number of cores and processes
+     */
+    string makeFixture(int cores, int processes)
+    {
+        fs::path root = fs::path(fixtureRoot) / ("cores" + to_string(cores) + "-pids" + to_string(processes));
+        if (fs::exists(root))
+        {
+            return root;
+        }
+        fs::create_directories(root);
+
+        string stat = "cpu  4705 356 584 3699176 23060 0 277 0 0 0\n";
+        for (int i = 0; i < cores; i++)
+        {
+            stat += "cpu" + to_string(i) + " 1393280 32966 572056 13343292 6130 0 17875 0 0 0\n";
+        }
+        stat += "intr 114930548 113199788 3 0 5 263 0 4 [...]\nctxt 1990473\nbtime 1062191376\nprocesses 2915\n";
+        writeFile(root / "stat", stat);
+
+        writeFile(root / "meminfo",
+                  "MemTotal:       16307040 kB\n"
+                  "MemFree:         1064372 kB\n"
+                  "MemAvailable:    9283268 kB\n"
+                  "Buffers:          372076 kB\n"
+                  "Cached:          7865972 kB\n"
+                  "SwapCached:            0 kB\n"
+                  "Active:          5124148 kB\n"
+                  "Inactive:        8270412 kB\n"
+                  "SwapTotal:       8388604 kB\n"
+                  "SwapFree:        8388604 kB\n"
+                  "Dirty:               412 kB\n");
+        writeFile(root / "uptime", "350735.47 234388.90\n");
+
+        const char *commands[] = {"/usr/bin/bash", "/usr/lib/firefox/firefox -contentproc -childID 12", "/usr/bin/pipewire", "/usr/lib/systemd/systemd --user"};
+        for (int pid = 1; pid <= processes; pid++)
+        {
+            fs::path dir = root / to_string(pid);
+            fs::create_directory(dir);
+
+            string cmdline = commands[pid % 4];
+            replace(cmdline.begin(), cmdline.end(), ' ', '\0');
+            string comm = fs::path(cmdline.c_str()).filename().string().substr(0, 15);
+            writeFile(dir / "cmdline", cmdline);
+            writeFile(dir / "comm", comm);
+            writeFile(dir / "stat", procStat(pid, comm, 1, pid));
+        }
+
+        // The process we are looking for is the very last one
+        writeFile(root / to_string(processes) / "cmdline", string("/opt/discord/Discord\0--type=renderer", 36));
+
+        // Entries that aren't processes
+        fs::create_directory(root / "self");
+        fs::create_directory(root / "sys");
+        return root;
+    }
+
+    void benchProcfs()
+    {
+        for (int cores : {64, 1024})
+        {
+            string fixture = "cores=" + to_string(cores);
+            setProcRoot(makeFixture(cores, 0));
+            cpuSampler = CpuSampler();
+
+            run("getRAM", fixture, []()
+                { keep(getRAM()); });
+            run("getCPU", fixture, []()
+                { keep(getCPU()); });
+            coreSampler = CoreSampler();
+            run("CoreSampler", fixture, []()
+                {
+                    keep(coreSampler.read());
+                    coreSampler.compute();
+                });
+            run("ms_uptime", fixture, []()
+                { keep(ms_uptime()); });
+        }
+    }
+
+    void benchProcessRunning()
+    {
+        for (int processes : {500, 50000})
+        {
+            string fixture = "pids=" + to_string(processes);
+            setProcRoot(makeFixture(1, processes));
+
+            run("processRunning", fixture + ",found", []()
+                { keep(processRunning("discord")); });
+            run("processRunning", fixture + ",missing", []()
+                { keep(processRunning("vesktop")); });
+
+            ProcessScanner scanner({"discord", "vesktop", "steam", "firefox"});
+            run("ProcessScanner::scan", fixture + ",patterns=4", [&scanner]()
+                { keep(scanner.scan()); });
+
+            // Nothing changes between rescans, so this is the steady-state cost without process events
+            buildMatchers();
+            ProcessTable table;
+            table.match = [](const string &name, string &asset)
+            { return windowMatcher.match(lower(name), asset); };
+            table.init();
+            run("ProcessTable::rescan", fixture + ",unchanged", [&table]()
+                { keep(table.rescan()); });
+            run("ProcessTable::identify", fixture, [&table, processes]()
+                { keep(table.identify(processes)); });
+        }
+    }
+
+    /**
+     * @brief Browser pid 100 with the given number of children, laid out in cgroups like:
+     * "scope" launched into an app scope of its own, "parent" sharing it with its parent pid 99,
+     * "session" double-forked by a WM (pid 99) into the session scope, so reparented to init
+     */
+    string makeTreeFixture(int children, const string &layout)
+    {
+        fs::path root = fs::path(fixtureRoot) / ("tree" + to_string(children) + "-" + layout);
+        if (fs::exists(root))
+        {
+            return root;
+        }
+
+        string session = "user.slice/user-1000.slice/session-1.scope";
+        string scope = layout == "session" ? session : "user.slice/user-1000.slice/user@1000.service/app.slice/app-browser-100.scope";
+        fs::create_directories(root / "cgroup" / scope);
+        writeFile(root / "cgroup" / scope / "cpu.stat", "usage_usec 123456789\nuser_usec 100000000\nsystem_usec 23456789\n");
+        writeFile(root / "cgroup" / scope / "memory.stat",
+                  "anon 104857600\nfile 52428800\nkernel 1048576\nkernel_stack 65536\npagetables 524288\n"
+                  "shmem 1048576\nfile_mapped 20971520\nfile_dirty 0\nfile_writeback 0\n");
+
+        fs::create_directories(root / "proc" / "1");
+        writeFile(root / "proc" / "1" / "stat", "1 (systemd) S 0 1 1 0 -1 4194560 100 0 0 0 50 20 0 0 20 0 1 0 1 1000000 2500\n");
+        writeFile(root / "proc" / "1" / "cgroup", "0::/init.scope\n");
+
+        string procs;
+        for (int pid = 99; pid <= 100 + children; pid++)
+        {
+            fs::path dir = root / "proc" / to_string(pid);
+            fs::create_directories(dir);
+            int ppid = pid == 99 ? 1 : pid == 100 ? (layout == "session" ? 1 : 99) : 100;
+            string cgroup = pid == 99 && layout == "scope" ? session : scope;
+            writeFile(dir / "stat", to_string(pid) + " (browser) S " + to_string(ppid) + " 100 100 0 -1 4194304 100 0 0 0 1234 567 0 0 20 0 1 0 100 1000000 2500\n");
+            writeFile(dir / "statm", "250000 2500 500 10 0 20000 0\n");
+            writeFile(dir / "cgroup", "0::/" + cgroup + "\n");
+            if (cgroup == scope)
+            {
+                procs += to_string(pid) + "\n";
+            }
+        }
+        writeFile(root / "cgroup" / scope / "cgroup.procs", procs);
+        return root;
+    }
+
+    void benchAppSampler()
+    {
+        for (int children : {10, 1000})
+        {
+            // Only a scope of the app's own may be sampled as a whole
+            for (string layout : {"parent", "session", "scope"})
+            {
+                fs::path root = makeTreeFixture(children, layout);
+                setProcRoot(root / "proc");
+                cgroupRoot = root / "cgroup";
+
+                ProcessTreeSampler sampler;
+                sampler.setRoot(100);
+                bool expected = layout == "scope";
+                if (sampler.usingCgroup() != expected)
+                {
+                    fail("ProcessTreeSampler", "cgroup " + string(expected ? "not used" : "used although shared") + " with layout " + layout);
+                    continue;
+                }
+
+                // The cgroup costs the same for any number of children, the tree grows with them
+                string fixture = "children=" + to_string(children) + "," + layout + (expected ? ",cgroup" : ",tree");
+                run("ProcessTreeSampler::sample", fixture, [&sampler]()
+                    { keep(sampler.sample(Timer::nowNs())); });
+            }
+        }
+        cgroupRoot = "/sys/fs/cgroup";
+    }
+
+    /**
+     * @brief Patterns from the asset files that only make sense whole must not be split into alternatives
+     */
+    void checkAssetMatcher()
+    {
+        AssetMatcher matcher;
+        matcher.addPattern("(a)|(b)\\2", "backreference");
+        matcher.addPattern("(c)|(d", "invalid");
+        matcher.addPattern("b+|e", "plain");
+
+        struct Step
+        {
+            const char *name;
+            const char *expected; // empty for no match
+        } steps[] = {{"a", "backreference"}, {"bb", "backreference"}, {"bbb", "plain"}, {"c", ""}, {"e", "plain"}};
+
+        for (const auto &step : steps)
+        {
+            string value;
+            if (!matcher.match(step.name, value))
+            {
+                value = "";
+            }
+            if (value != step.expected)
+            {
+                fail("AssetMatcher::match", string(step.name) + " gave \"" + value + "\" instead of \"" + step.expected + "\"");
+            }
+        }
+    }
+
+    void benchAssets()
+    {
+        buildMatchers();
+
+        run("getWindowAsset", "builtin,exact", []()
+            { windowAssetCache.clear(); keep(getWindowAsset("Firefox")); });
+        run("getWindowAsset", "builtin,alias", []()
+            { windowAssetCache.clear(); keep(getWindowAsset("Minecraft 1.20.1")); });
+        run("getWindowAsset", "builtin,miss", []()
+            { windowAssetCache.clear(); keep(getWindowAsset("Some Unknown App")); });
+        run("getWindowAsset", "builtin,cached", []()
+            { keep(getWindowAsset("Minecraft 1.20.1")); });
+
+        // Misses clear the cache, so these show the matcher itself, which shouldn't grow with the aliases
+        for (int count : {100, 1000, 10000})
+        {
+            for (int i = 0; i < count; i++)
+            {
+                aliases["generated-app-" + to_string(i) + "( [0-9.]+)?"] = "generated";
+            }
+            buildMatchers();
+
+            string fixture = "aliases=" + to_string(aliases.size());
+            run("getWindowAsset", fixture + ",alias", []()
+                { windowAssetCache.clear(); keep(getWindowAsset("Minecraft 1.20.1")); });
+            run("getWindowAsset", fixture + ",miss", []()
+                { windowAssetCache.clear(); keep(getWindowAsset("Some Unknown App")); });
+            run("getWindowAsset", fixture + ",generated", []()
+                { windowAssetCache.clear(); keep(getWindowAsset("Generated-App-42 1.0")); });
+        }
+
+        run("getDistroAsset", "lsb", []()
+            { keep(getDistroAsset("ManjaroLinux")); });
+        run("getDistroAsset", "miss", []()
+            { keep(getDistroAsset("Slackware")); });
+        run("getDistro", "release-file", []()
+            { keep(getDistro()); });
+    }
+
+    void benchConfig()
+    {
+        run("parseConfigOption", "usage-sleep", []()
+            {
+                Config c;
+                char option[] = "usage-sleep=1000";
+                parseConfigOption(&c, option, false);
+                keep(c);
+            });
+        run("parseConfigOption", "--no-small-image", []()
+            {
+                Config c;
+                char option[] = "--no-small-image";
+                parseConfigOption(&c, option, true);
+                keep(c);
+            });
+    }
+
+    /**
+     * @brief Stand-in for an IPC server on a unix socket, serving one client at a time with handler
+     */
+    struct StandInServer
+    {
+        int fd = -1;
+        string path;
+        thread worker;
+
+        bool listen(const string &p, function<void(int)> handler)
+        {
+            path = p;
+            fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+            struct sockaddr_un addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+            if (fd == -1 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || ::listen(fd, 4) == -1)
+            {
+                return false;
+            }
+
+            worker = thread([this, handler]()
+                            {
+                                int client;
+                                while ((client = accept(fd, nullptr, nullptr)) != -1)
+                                {
+                                    handler(client);
+                                    close(client);
+                                } });
+            return true;
+        }
+
+        ~StandInServer()
+        {
+            if (fd != -1)
+            {
+                shutdown(fd, SHUT_RDWR);
+                if (worker.joinable())
+                {
+                    worker.join();
+                }
+                close(fd);
+                unlink(path.c_str());
+            }
+        }
+    };
+
+    void writeAll(int fd, const string &data)
+    {
+        keep(send(fd, data.data(), data.size(), MSG_NOSIGNAL));
+    }
+
+    // Keep the connection open until the client goes away, like a compositor with nothing to report
+    void drain(int client)
+    {
+        char buf[256];
+        while (recv(client, buf, sizeof(buf), 0) > 0)
+        {
+        }
+    }
+
+    string discordFrame(uint32_t opcode, const string &body)
+    {
+        string out;
+        for (uint32_t value : {opcode, (uint32_t)body.size()})
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                out += (char)((value >> (8 * i)) & 0xff);
+            }
+        }
+        return out + body;
+    }
+
+    bool readDiscordFrame(int client, uint32_t &opcode, string &body)
+    {
+        unsigned char header[8];
+        if (!CompositorBackend::readExactly(client, (char *)header, sizeof(header)))
+        {
+            return false;
+        }
+        opcode = header[0] | header[1] << 8 | header[2] << 16 | (uint32_t)header[3] << 24;
+        uint32_t length = header[4] | header[5] << 8 | header[6] << 16 | (uint32_t)header[7] << 24;
+        body.resize(length);
+        return CompositorBackend::readExactly(client, &body[0], length);
+    }
+
+    /**
+     * @brief Stand-in Discord client: answers the handshake with READY and every SET_ACTIVITY
+     * with success. The first session is closed with a CLOSE frame after its first activity,
+     * like Discord restarting, to check the reconnect and the replay of that activity.
+     */
+    struct DiscordStandIn
+    {
+        mutex lock;
+        vector<string> seen; // "handshake", "activity:<details>" or what was wrong
+        int sessions = 0;
+
+        void record(const string &what)
+        {
+            lock_guard<mutex> guard(lock);
+            seen.push_back(what);
+        }
+
+        vector<string> snapshot()
+        {
+            lock_guard<mutex> guard(lock);
+            return seen;
+        }
+
+        void serve(int client)
+        {
+            uint32_t opcode;
+            string body;
+            // Liveness probes connect and hang up without a word
+            if (!readDiscordFrame(client, opcode, body))
+            {
+                return;
+            }
+
+            string clientId;
+            long long version = 0;
+            if (opcode != IPC_HANDSHAKE || !jsonGetString(body, "client_id", clientId) || !jsonGetInt(body, "v", version) || version != 1)
+            {
+                record("bad handshake");
+                return;
+            }
+            record("handshake");
+            int session = ++sessions;
+            writeAll(client, discordFrame(IPC_FRAME, "{\"cmd\":\"DISPATCH\",\"evt\":\"READY\",\"data\":{\"v\":1,\"user\":{\"id\":\"1\",\"username\":\"stand-in\"}},\"nonce\":null}"));
+
+            while (readDiscordFrame(client, opcode, body))
+            {
+                string cmd, nonce, details;
+                long long pid = 0;
+                if (opcode != IPC_FRAME || !jsonGetString(body, "cmd", cmd) || cmd != "SET_ACTIVITY" ||
+                    !jsonGetString(body, "nonce", nonce) || !jsonGetInt(body, "pid", pid) || pid != getpid())
+                {
+                    record("bad frame");
+                    return;
+                }
+                jsonGetString(body, "details", details);
+                record("activity:" + details);
+                writeAll(client, discordFrame(IPC_FRAME, "{\"cmd\":\"SET_ACTIVITY\",\"evt\":null,\"data\":{},\"nonce\":\"" + nonce + "\"}"));
+
+                if (session == 1)
+                {
+                    writeAll(client, discordFrame(IPC_CLOSE, "{\"code\":1000,\"message\":\"stand-in restart\"}"));
+                    return;
+                }
+            }
+        }
+    };
+
+    /**
+     * @brief Without process events, rescans have to notice an exec and a reused pid on their own
+     */
+    void checkProcessTable()
+    {
+        fs::path root = makeFixture(1, 100);
+        setProcRoot(root);
+        buildMatchers();
+
+        ProcessTable table;
+        table.match = [](const string &name, string &asset)
+        { return windowMatcher.match(lower(name), asset); };
+        table.init();
+
+        auto expect = [&table](const string &step, const vector<string> &names)
+        {
+            table.rescan();
+            vector<string> running = table.names();
+            if (running != names)
+            {
+                string got;
+                for (const auto &name : running)
+                {
+                    got += " " + name;
+                }
+                fail("ProcessTable::rescan", step + ", running:" + got);
+            }
+        };
+        expect("initial", {"firefox", "Discord"});
+
+        // pid 50 execs blender, keeping its pid and start time
+        writeFile(root / "50" / "cmdline", "/usr/bin/blender");
+        writeFile(root / "50" / "stat", procStat(50, "blender", 1, 50));
+        expect("exec", {"firefox", "Discord", "blender"});
+
+        // pid 50 exits and is reused by something else
+        writeFile(root / "50" / "cmdline", "/usr/bin/bash");
+        writeFile(root / "50" / "stat", procStat(50, "bash", 1, 5000));
+        expect("pid reuse", {"firefox", "Discord"});
+        setProcRoot("/proc");
+    }
+
+    void benchDiscordIpc()
+    {
+        const string name = "DiscordIpcClient";
+        string runtime = fixtureRoot + "/discord";
+        fs::create_directories(runtime);
+        setenv("XDG_RUNTIME_DIR", runtime.c_str(), 1);
+
+        DiscordStandIn discord;
+        StandInServer server;
+        if (!server.listen(runtime + "/" DISCORD_IPC_PREFIX "0", [&discord](int client)
+                           { discord.serve(client); }))
+        {
+            skip(name, "can't listen on a unix socket");
+            return;
+        }
+
+        // Wired up like main does, against a reactor of our own
+        Reactor loop;
+        DiscordConnection conn;
+        DiscordIpcClient client;
+        ActivityPublisher activities;
+        int results = 0;
+        int readies = 0;
+
+        client.onResult = [&results](bool ok, const string &)
+        { results += ok; };
+        client.onWantWrite = [&](bool wantWrite)
+        { loop.modify(client.fd, wantWrite ? EPOLLIN | EPOLLOUT : EPOLLIN); };
+        client.onReady = [&conn]()
+        { conn.ready(); };
+        client.onLost = [&conn](const string &message)
+        { conn.lost(message); };
+        activities.sink = [&](const ActivityPayload &payload)
+        {
+            if (conn.isReady())
+            {
+                client.setActivity(payload);
+            }
+        };
+
+        conn.open = [&]()
+        {
+            if (!client.connect())
+            {
+                return false;
+            }
+            uint32_t interest = client.wantsWrite() ? EPOLLIN | EPOLLOUT : EPOLLIN;
+            return loop.add(client.fd, [&client](uint32_t events)
+                            { client.dispatch(events); }, interest);
+        };
+        conn.close = [&]()
+        {
+            if (client.fd != -1)
+            {
+                loop.remove(client.fd);
+            }
+            client.disconnect();
+        };
+        conn.onReady = [&]()
+        {
+            if (++readies == 1)
+            {
+                ActivityPayload payload;
+                payload.details = "Stand-in A";
+                payload.largeImage = "tux";
+                activities.submit(payload, chrono::steady_clock::now());
+                return;
+            }
+            activities.replay();
+        };
+
+        vector<string> expected = {"handshake", "activity:Stand-in A", "handshake", "activity:Stand-in A"};
+        Timer poll;
+        long deadline = Timer::nowNs() + 5000000000L;
+        poll.start(10);
+        loop.add(poll, [&]()
+                 {
+                     if ((discord.snapshot().size() >= expected.size() && results >= 2) || Timer::nowNs() > deadline)
+                     {
+                         loop.stop();
+                     }
+                 });
+
+        long startNs = Timer::nowNs();
+        conn.init(loop);
+        conn.connect();
+        loop.run();
+
+        vector<string> seen = discord.snapshot();
+        string got;
+        for (const auto &item : seen)
+        {
+            got += (got.empty() ? "" : ",") + item;
+        }
+
+        if (seen != expected)
+        {
+            fail(name, "stand-in saw " + got);
+        }
+        else if (results != 2 || conn.reconnects != 1 || !conn.isReady())
+        {
+            fail(name, "results=" + to_string(results) + " " + conn.summary());
+        }
+        else if (!checkOnly && (filter.empty() || name.find(filter) != string::npos))
+        {
+            printf("{\"benchmark\":\"%s\",\"fixture\":\"close-and-replay\",\"ms\":%.1f}\n",
+                   name.c_str(), (Timer::nowNs() - startNs) / 1e6);
+        }
+
+        conn.close();
+        unsetenv("XDG_RUNTIME_DIR");
+    }
+
+    string swayWindow(int id, const string &appId, bool focused)
+    {
+        return "{\"id\":" + to_string(id) + ",\"type\":\"con\",\"focused\":" + (focused ? "true" : "false") +
+               ",\"name\":\"" + appId + " window " + to_string(id) + "\",\"app_id\":\"" + appId +
+               "\",\"pid\":" + to_string(1000 + id) + ",\"nodes\":[],\"floating_nodes\":[]}";
+    }
+
+    void benchSway()
+    {
+        const string name = "SwayEvents";
+
+        // Root, one output and workspace, then the windows
+        string tree = "{\"id\":1,\"type\":\"root\",\"focused\":false,\"name\":\"root\",\"nodes\":[{\"id\":2,\"type\":\"output\",\"focused\":false,"
+                      "\"name\":\"DP-1\",\"nodes\":[{\"id\":3,\"type\":\"workspace\",\"focused\":false,\"name\":\"1\",\"nodes\":[";
+        for (int id = 10; id < 60; id++)
+        {
+            tree += (id > 10 ? "," : "") + swayWindow(id, id == 42 ? "firefox" : "foot", id == 42);
+        }
+        tree += "]}]}]}";
+
+        auto serve = [&tree](int client)
+        {
+                               char header[SWAY_IPC_HEADER_SIZE];
+                               while (SwayEvents::readExactly(client, header, sizeof(header)))
+                               {
+                                   uint32_t length, type;
+                                   memcpy(&length, header + 6, sizeof(length));
+                                   memcpy(&type, header + 10, sizeof(type));
+                                   string payload(length, '\0');
+                                   SwayEvents::readExactly(client, &payload[0], length);
+
+                                   if (type == SWAY_IPC_GET_TREE)
+                                   {
+                                       writeAll(client, SwayEvents::message(type, tree));
+                                       continue;
+                                   }
+
+                                   // Without workspace events, switching to an empty workspace would go unnoticed
+                                   bool complete = payload.find("\"window\"") != string::npos && payload.find("\"workspace\"") != string::npos;
+                                   writeAll(client, SwayEvents::message(type, complete ? "{\"success\":true}" : "{\"success\":false}"));
+                                   if (type == SWAY_IPC_SUBSCRIBE)
+                                   {
+                                       drain(client);
+                                       return;
+                                   }
+                               }
+        };
+
+        StandInServer server;
+        if (!server.listen(fixtureRoot + "/sway.sock", serve))
+        {
+            skip(name, "can't listen on a unix socket");
+            return;
+        }
+        setenv("SWAYSOCK", server.path.c_str(), 1);
+
+        SwayEvents events;
+        events.watchTitle = true;
+        if (!events.subscribe() || events.activeClass != "firefox" || events.activePid != 1042)
+        {
+            fail(name, "subscribe: class=" + events.activeClass + " pid=" + to_string(events.activePid));
+            unsetenv("SWAYSOCK");
+            return;
+        }
+        run("SwayEvents::subscribe", "windows=50", [&events]()
+            {
+                events.disconnect();
+                keep(events.subscribe());
+            });
+        events.disconnect();
+
+        // Events go through a socketpair, so only the parsing is measured
+        int sv[2];
+        socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv);
+        events.fd = sv[0];
+
+        auto window = [](const string &change, int id, const string &appId)
+        { return SwayEvents::message(SWAY_IPC_EVENT_WINDOW, "{\"change\":\"" + change + "\",\"container\":" + swayWindow(id, appId, true) + "}"); };
+        auto workspace = [](const string &nodes)
+        {
+            return SwayEvents::message(SWAY_IPC_EVENT_WORKSPACE, "{\"change\":\"focus\",\"current\":{\"id\":4,\"type\":\"workspace\",\"focused\":true,\"name\":\"2\","
+                                                                 "\"nodes\":[" + nodes + "],\"floating_nodes\":[],\"focus\":[]},\"old\":{\"id\":3,\"type\":\"workspace\",\"name\":\"1\"}}");
+        };
+        struct Step
+        {
+            const char *what;
+            string message;
+            bool changed;
+            const char *appId;
+            const char *title;
+        };
+        vector<Step> steps = {
+            {"focus", window("focus", 43, "foot"), true, "foot", "foot window 43"},
+            {"title of another window", SwayEvents::message(SWAY_IPC_EVENT_WINDOW, "{\"change\":\"title\",\"container\":{\"id\":42,\"name\":\"other\"}}"), false, "foot", "foot window 43"},
+            {"title", SwayEvents::message(SWAY_IPC_EVENT_WINDOW, "{\"change\":\"title\",\"container\":{\"id\":43,\"type\":\"con\",\"name\":\"vim\"}}"), true, "foot", "vim"},
+            {"workspace with windows", workspace(swayWindow(44, "mpv", true)), false, "foot", "vim"},
+            {"empty workspace", workspace(""), true, "", ""},
+            {"focus back", window("focus", 42, "firefox"), true, "firefox", "firefox window 42"},
+            {"close", window("close", 42, "firefox"), true, "", ""},
+        };
+        for (const auto &step : steps)
+        {
+            writeAll(sv[1], step.message);
+            bool changed = events.dispatch();
+            if (changed != step.changed || events.activeClass != step.appId || events.activeTitle != step.title)
+            {
+                fail(name, string(step.what) + ": changed=" + to_string(changed) + " class=" + events.activeClass + " title=" + events.activeTitle);
+            }
+        }
+
+        // A compositor that isn't there yet is retried from retryTimer, without anyone calling dispatch()
+        {
+            string path = fixtureRoot + "/sway-late.sock";
+            setenv("SWAYSOCK", path.c_str(), 1);
+            // Declared first so it outlives the client, whose connection it is draining
+            StandInServer lateServer;
+            SwayEvents late;
+            late.init();
+
+            lateServer.listen(path, serve);
+            Reactor loop;
+            Timer deadline;
+            deadline.arm(Timer::nowNs() + 2000000000L);
+            loop.add(late.retryTimer, [&]()
+                     {
+                         if (late.reconnect())
+                         {
+                             loop.stop();
+                         }
+                     });
+            loop.add(deadline, [&loop]()
+                     { loop.stop(); });
+            loop.run();
+
+            if (late.fd == -1 || late.activeClass != "firefox")
+            {
+                fail(name, "not reconnected from retryTimer, backoff=" + to_string(late.backoffMs) + "ms");
+            }
+            setenv("SWAYSOCK", server.path.c_str(), 1);
+        }
+
+        string focus[2] = {window("focus", 42, "firefox"), window("focus", 43, "foot")};
+        int next = 0;
+        run("SwayEvents::dispatch", "focus", [&]()
+            {
+                writeAll(sv[1], focus[next ^= 1]);
+                keep(events.dispatch());
+            });
+        close(sv[1]);
+        unsetenv("SWAYSOCK");
+    }
+
+    string niriWindow(int id, const string &appId, bool focused, const string &title = "")
+    {
+        return "{\"id\":" + to_string(id) + ",\"title\":\"" + (title.empty() ? appId + " window " + to_string(id) : title) + "\",\"app_id\":\"" + appId +
+               "\",\"pid\":" + to_string(1000 + id) + ",\"workspace_id\":1,\"is_focused\":" + (focused ? "true" : "false") +
+               ",\"is_floating\":false,\"is_urgent\":false}";
+    }
+
+    void benchNiri()
+    {
+        const string name = "NiriEvents";
+
+        string windows = "{\"WindowsChanged\":{\"windows\":[";
+        for (int id = 10; id < 60; id++)
+        {
+            windows += (id > 10 ? "," : "") + niriWindow(id, id == 42 ? "firefox" : "foot", id == 42);
+        }
+        windows += "]}}\n";
+
+        StandInServer server;
+        if (!server.listen(fixtureRoot + "/niri.sock", [&windows](int client)
+                           {
+                               char request[32];
+                               ssize_t n = recv(client, request, sizeof(request), 0);
+                               if (n <= 0)
+                               {
+                                   return;
+                               }
+                               if (string(request, n) != "\"EventStream\"\n")
+                               {
+                                   writeAll(client, "{\"Err\":\"unknown request\"}\n");
+                                   return;
+                               }
+                               writeAll(client, "{\"Ok\":\"Handled\"}\n{\"WorkspacesChanged\":{\"workspaces\":[{\"id\":1,\"idx\":1,\"name\":null,\"is_focused\":true}]}}\n" + windows);
+                               drain(client); }))
+        {
+            skip(name, "can't listen on a unix socket");
+            return;
+        }
+        setenv("NIRI_SOCKET", server.path.c_str(), 1);
+
+        NiriEvents events;
+        events.watchTitle = true;
+        if (!events.subscribe() || events.activeClass != "firefox" || events.activePid != 1042)
+        {
+            fail(name, "subscribe: class=" + events.activeClass + " pid=" + to_string(events.activePid));
+            unsetenv("NIRI_SOCKET");
+            return;
+        }
+        run("NiriEvents::subscribe", "windows=50", [&events]()
+            {
+                events.disconnect();
+                keep(events.subscribe());
+            });
+        events.disconnect();
+
+        int sv[2];
+        socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv);
+        events.fd = sv[0];
+
+        struct Step
+        {
+            const char *what;
+            string line;
+            bool changed;
+            const char *appId;
+            const char *title;
+        };
+        vector<Step> steps = {
+            {"title", "{\"WindowOpenedOrChanged\":{\"window\":" + niriWindow(42, "firefox", true, "news") + "}}\n", true, "firefox", "news"},
+            {"title of another window", "{\"WindowOpenedOrChanged\":{\"window\":" + niriWindow(43, "foot", false, "htop") + "}}\n", false, "firefox", "news"},
+            {"focus", "{\"WindowFocusChanged\":{\"id\":43}}\n", true, "foot", "htop"},
+            {"no focus", "{\"WindowFocusChanged\":{\"id\":null}}\n", true, "", ""},
+            {"opened focused", "{\"WindowOpenedOrChanged\":{\"window\":" + niriWindow(60, "mpv", true) + "}}\n", true, "mpv", "mpv window 60"},
+            {"close", "{\"WindowClosed\":{\"id\":60}}\n", true, "", ""},
+        };
+        for (const auto &step : steps)
+        {
+            writeAll(sv[1], step.line);
+            bool changed = events.dispatch();
+            if (changed != step.changed || events.activeClass != step.appId || events.activeTitle != step.title)
+            {
+                fail(name, string(step.what) + ": changed=" + to_string(changed) + " class=" + events.activeClass + " title=" + events.activeTitle);
+            }
+        }
+
+        string focus[2] = {"{\"WindowFocusChanged\":{\"id\":42}}\n", "{\"WindowFocusChanged\":{\"id\":43}}\n"};
+        int next = 0;
+        run("NiriEvents::dispatch", "focus", [&]()
+            {
+                writeAll(sv[1], focus[next ^= 1]);
+                keep(events.dispatch());
+            });
+        run("NiriEvents::dispatch", "title", [&]()
+            {
+                writeAll(sv[1], "{\"WindowOpenedOrChanged\":{\"window\":" + niriWindow(43, "foot", true) + "}}\n");
+                keep(events.dispatch());
+            });
+        close(sv[1]);
+        unsetenv("NIRI_SOCKET");
+    }
+
+    /**
+     * @brief The window focused at subscribe time has to be followed like one focused later
+     */
+    void checkHyprland()
+    {
+        const string name = "HyprlandEvents";
+        string dir = fixtureRoot + "/hypr/stand-in";
+        fs::create_directories(dir);
+
+        StandInServer requests;
+        StandInServer events;
+        bool listening = requests.listen(dir + "/.socket.sock", [](int client)
+                                         {
+                                             char request[64];
+                                             if (recv(client, request, sizeof(request), 0) == 12 && memcmp(request, "activewindow", 12) == 0)
+                                             {
+                                                 writeAll(client, "Window 55d0b2a8e6b0 -> news - Firefox:\n\tmapped: 1\n\tclass: firefox\n"
+                                                                  "\ttitle: news - Firefox\n\tpid: 1042\n\n");
+                                             } });
+        if (!listening || !events.listen(dir + "/.socket2.sock", drain))
+        {
+            skip(name, "can't listen on a unix socket");
+            return;
+        }
+        setenv("XDG_RUNTIME_DIR", fixtureRoot.c_str(), 1);
+        setenv("HYPRLAND_INSTANCE_SIGNATURE", "stand-in", 1);
+
+        HyprlandEvents hypr;
+        if (!hypr.subscribe() || hypr.activeClass != "firefox" || hypr.activePid != 1042 || hypr.activeAddress != "55d0b2a8e6b0")
+        {
+            fail(name, "subscribe: class=" + hypr.activeClass + " address=" + hypr.activeAddress);
+        }
+        else
+        {
+            int sv[2];
+            socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv);
+            hypr.disconnect();
+            hypr.fd = sv[0];
+
+            writeAll(sv[1], "closewindow>>55d0b2a8e6b0\n");
+            if (!hypr.dispatch() || !hypr.activeClass.empty())
+            {
+                fail(name, "close of the window focused at subscribe: class=" + hypr.activeClass);
+            }
+            close(sv[1]);
+        }
+
+        hypr.disconnect();
+        unsetenv("HYPRLAND_INSTANCE_SIGNATURE");
+        unsetenv("XDG_RUNTIME_DIR");
+    }
+
+    void benchX()
+    {
+        xcb_connection_t *conn = xcb_connect(NULL, NULL);
+        if (xcb_connection_has_error(conn))
+        {
+            xcb_disconnect(conn);
+            skip("get_property", "no X display, run under xvfb-run");
+            return;
+        }
+
+        XcbAtoms a;
+        run("intern_atoms", "batch", [conn, &a]()
+            { keep(a.intern(conn)); });
+
+        xcb_window_t root = screenRoot(conn);
+        run("get_property", "window", [conn, root, &a]()
+            { keep(windowReply(conn, requestProperty(conn, root, a.netSupportingWmCheck, XCB_ATOM_WINDOW))); });
+        run("wm_info", "xcb", [conn, &a]()
+            { keep(wm_info(conn, a)); });
+
+        xcb_disconnect(conn);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && string(argv[1]) == "--check")
+    {
+        checkOnly = true;
+    }
+    else if (argc > 1)
+    {
+        filter = argv[1];
+    }
+
+    char tmpl[] = "/tmp/brpc-bench-XXXXXX";
+    if (!mkdtemp(tmpl))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    fixtureRoot = tmpl;
+
+    if (!checkOnly)
+    {
+        benchProcfs();
+        benchProcessRunning();
+        benchAssets();
+        benchConfig();
+    }
+    benchAppSampler();
+    checkProcessTable();
+    checkAssetMatcher();
+    benchDiscordIpc();
+    benchSway();
+    benchNiri();
+    checkHyprland();
+    if (!checkOnly)
+    {
+        benchX();
+    }
+
+    error_code ec;
+    fs::remove_all(fixtureRoot, ec);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,504 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+/*
+ * Asset database
+ *
+ * Users can map window classes and distros to image keys without rebuilding, in
+ * /etc/brpc/assets (system-wide) and ~/.config/brpc/assets (per user). One rule per line:
+ *
+ *   app    <image> [class]      exact window class, defaults to the image key
+ *   alias  <image> <pattern>    regular expression matched against the lowercased window class
+ *   distro <image> <pattern>    regular expression matched against the distro name
+ *
+ * Both files are compiled into a binary index (brpc --compile-assets) which the daemon mmaps,
+ * so nothing has to be parsed at startup. Exact names are looked up directly in the mapped file.
+ */
+
+#define ASSET_INDEX_MAGIC "BRPCIDX1"
+#define ASSET_INDEX_VERSION 1
+
+enum AssetKind : uint8_t
+{
+    ASSET_APP,
+    ASSET_ALIAS,
+    ASSET_DISTRO
+};
+
+struct AssetRule
+{
+    AssetKind kind;
+    string image;
+    string key; // class name for apps, pattern otherwise
+};
+
+struct AssetIndexHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t exactCount;   // sorted by kind and key, for binary search
+    uint32_t patternCount; // in priority order, following the exact entries
+    uint32_t stringsSize;
+    int64_t sourceMtimes[2]; // of the source files it was compiled from, 0 if missing
+};
+
+struct AssetIndexEntry
+{
+    uint8_t kind;
+    uint8_t reserved[3];
+    uint32_t keyOffset;
+    uint32_t keyLength;
+    uint32_t imageOffset;
+    uint32_t imageLength;
+};
+
+/**
+ * @brief Asset source files, lowest priority first
+ */
+vector<string> assetSourcePaths()
+{
+    vector<string> paths = {"/etc/brpc/assets"};
+
+    const char *home = getenv("HOME");
+    if (home)
+    {
+        paths.push_back(string(home) + "/.config/brpc/assets");
+    }
+    return paths;
+}
+
+/**
+ * @brief $XDG_CACHE_HOME/brpc, empty if there is nowhere to put it
+ */
+string cacheDir()
+{
+    const char *cache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+
+    if (cache && *cache)
+    {
+        return string(cache) + "/brpc";
+    }
+    if (home)
+    {
+        return string(home) + "/.cache/brpc";
+    }
+    return "";
+}
+
+string assetIndexPath()
+{
+    string dir = cacheDir();
+    return dir.empty() ? "" : dir + "/assets.idx";
+}
+
+int64_t fileMtime(const string &path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+    {
+        return 0;
+    }
+    return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+/**
+ * @brief Read the rules of one source file
+ */
+bool parseAssetFile(const string &path, vector<AssetRule> &rules)
+{
+    ifstream file(path);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    string line;
+    int lineNumber = 0;
+    while (getline(file, line))
+    {
+        lineNumber++;
+
+        size_t start = line.find_first_not_of(" \t");
+        if (start == string::npos || line[start] == '#')
+        {
+            continue;
+        }
+
+        size_t kindEnd = line.find_first_of(" \t", start);
+        size_t imageStart = line.find_first_not_of(" \t", kindEnd);
+        if (kindEnd == string::npos || imageStart == string::npos)
+        {
+            LOG(path + ":" + to_string(lineNumber) + ": missing image key", LogType::WARN);
+            continue;
+        }
+
+        size_t imageEnd = line.find_first_of(" \t", imageStart);
+        size_t keyStart = imageEnd == string::npos ? string::npos : line.find_first_not_of(" \t", imageEnd);
+        size_t keyEnd = line.find_last_not_of(" \t\r");
+
+        string kind = line.substr(start, kindEnd - start);
+        AssetRule rule;
+        rule.image = line.substr(imageStart, imageEnd - imageStart);
+        rule.key = keyStart == string::npos ? "" : line.substr(keyStart, keyEnd + 1 - keyStart);
+
+        if (kind == "app")
+        {
+            rule.kind = ASSET_APP;
+            // Window classes are lowercased before matching
+            rule.key = rule.key.empty() ? rule.image : rule.key;
+            transform(rule.key.begin(), rule.key.end(), rule.key.begin(),
+                      [](unsigned char c)
+                      { return tolower(c); });
+        }
+        else if (kind == "alias" && !rule.key.empty())
+        {
+            rule.kind = ASSET_ALIAS;
+        }
+        else if (kind == "distro" && !rule.key.empty())
+        {
+            rule.kind = ASSET_DISTRO;
+        }
+        else
+        {
+            LOG(path + ":" + to_string(lineNumber) + ": invalid rule", LogType::WARN);
+            continue;
+        }
+
+        rules.push_back(rule);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Compile the source files into a binary index at out.
+ * The index is written next to its final path and renamed over it, so readers never see half of it.
+ */
+bool compileAssetIndex(const vector<string> &sources, const string &out)
+{
+    // Later sources override earlier ones: their exact names replace, their patterns come first
+    map<pair<uint8_t, string>, string> exactRules;
+    vector<AssetRule> patternRules;
+    AssetIndexHeader header = {};
+
+    for (size_t i = 0; i < sources.size() && i < 2; i++)
+    {
+        vector<AssetRule> rules;
+        if (!parseAssetFile(sources[i], rules))
+        {
+            continue;
+        }
+        header.sourceMtimes[i] = fileMtime(sources[i]);
+
+        vector<AssetRule> patterns;
+        for (const auto &rule : rules)
+        {
+            if (rule.kind == ASSET_APP)
+            {
+                exactRules[{rule.kind, rule.key}] = rule.image;
+            }
+            else
+            {
+                patterns.push_back(rule);
+            }
+        }
+        patternRules.insert(patternRules.begin(), patterns.begin(), patterns.end());
+    }
+
+    string strings;
+    vector<AssetIndexEntry> entries;
+    auto addEntry = [&](uint8_t kind, const string &key, const string &image)
+    {
+        AssetIndexEntry entry = {};
+        entry.kind = kind;
+        entry.keyOffset = strings.size();
+        entry.keyLength = key.size();
+        strings += key;
+        entry.imageOffset = strings.size();
+        entry.imageLength = image.size();
+        strings += image;
+        entries.push_back(entry);
+    };
+
+    for (const auto &kv : exactRules)
+    {
+        addEntry(kv.first.first, kv.first.second, kv.second);
+    }
+    for (const auto &rule : patternRules)
+    {
+        addEntry(rule.kind, rule.key, rule.image);
+    }
+
+    memcpy(header.magic, ASSET_INDEX_MAGIC, sizeof(header.magic));
+    header.version = ASSET_INDEX_VERSION;
+    header.exactCount = exactRules.size();
+    header.patternCount = patternRules.size();
+    header.stringsSize = strings.size();
+
+    fs::path outPath(out);
+    error_code ec;
+    fs::create_directories(outPath.parent_path(), ec);
+
+    string tmp = out + ".tmp";
+    ofstream file(tmp, ios::binary | ios::trunc);
+    if (!file.is_open())
+    {
+        LOG("Failed to write asset index " + tmp, LogType::ERROR);
+        return false;
+    }
+
+    file.write((const char *)&header, sizeof(header));
+    file.write((const char *)entries.data(), entries.size() * sizeof(AssetIndexEntry));
+    file.write(strings.data(), strings.size());
+    file.close();
+
+    if (file.fail() || rename(tmp.c_str(), out.c_str()) != 0)
+    {
+        LOG("Failed to write asset index " + out, LogType::ERROR);
+        remove(tmp.c_str());
+        return false;
+    }
+
+    LOG("Compiled " + to_string(entries.size()) + " asset rules into " + out, LogType::DEBUG);
+    return true;
+}
+
+/**
+ * @brief Read-only view of a compiled asset index mapped into memory
+ */
+struct AssetIndex
+{
+    void *data = MAP_FAILED;
+    size_t size = 0;
+
+    const AssetIndexHeader *header = nullptr;
+    const AssetIndexEntry *entries = nullptr;
+    const char *strings = nullptr;
+
+    AssetIndex() {}
+    AssetIndex(const AssetIndex &) = delete;
+    AssetIndex &operator=(const AssetIndex &) = delete;
+
+    ~AssetIndex()
+    {
+        unload();
+    }
+
+    void unload()
+    {
+        if (data != MAP_FAILED)
+        {
+            munmap(data, size);
+        }
+        data = MAP_FAILED;
+        header = nullptr;
+        entries = nullptr;
+        strings = nullptr;
+        size = 0;
+    }
+
+    bool load(const string &path)
+    {
+        unload();
+
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(AssetIndexHeader))
+        {
+            close(fd);
+            return false;
+        }
+
+        size = st.st_size;
+        data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if (data == MAP_FAILED)
+        {
+            return false;
+        }
+
+        header = (const AssetIndexHeader *)data;
+        size_t entriesSize = ((size_t)header->exactCount + header->patternCount) * sizeof(AssetIndexEntry);
+
+        if (memcmp(header->magic, ASSET_INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != ASSET_INDEX_VERSION ||
+            sizeof(AssetIndexHeader) + entriesSize + header->stringsSize != size)
+        {
+            LOG("Ignoring invalid asset index " + path, LogType::WARN);
+            unload();
+            return false;
+        }
+
+        entries = (const AssetIndexEntry *)((const char *)data + sizeof(AssetIndexHeader));
+        strings = (const char *)entries + entriesSize;
+
+        // Make sure no entry points outside of the string table
+        for (uint32_t i = 0; i < header->exactCount + header->patternCount; i++)
+        {
+            const AssetIndexEntry &e = entries[i];
+            if ((uint64_t)e.keyOffset + e.keyLength > header->stringsSize ||
+                (uint64_t)e.imageOffset + e.imageLength > header->stringsSize)
+            {
+                LOG("Ignoring corrupt asset index " + path, LogType::WARN);
+                unload();
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool loaded() const
+    {
+        return header != nullptr;
+    }
+
+    string_view key(const AssetIndexEntry &e) const
+    {
+        return string_view(strings + e.keyOffset, e.keyLength);
+    }
+
+    string_view image(const AssetIndexEntry &e) const
+    {
+        return string_view(strings + e.imageOffset, e.imageLength);
+    }
+
+    /**
+     * @brief Binary search an exact name in the mapped file
+     */
+    bool lookup(AssetKind kind, const string &name, string &value) const
+    {
+        if (!loaded())
+        {
+            return false;
+        }
+
+        const AssetIndexEntry *begin = entries;
+        const AssetIndexEntry *end = entries + header->exactCount;
+        auto it = lower_bound(begin, end, make_pair((uint8_t)kind, string_view(name)),
+                              [this](const AssetIndexEntry &e, const pair<uint8_t, string_view> &wanted)
+                              { return make_pair(e.kind, key(e)) < wanted; });
+
+        if (it == end || it->kind != kind || key(*it) != name)
+        {
+            return false;
+        }
+
+        value = string(image(*it));
+        return true;
+    }
+
+    /**
+     * @brief Pattern rules of one kind, highest priority first
+     */
+    vector<pair<string, string>> patterns(AssetKind kind) const
+    {
+        vector<pair<string, string>> result;
+        if (!loaded())
+        {
+            return result;
+        }
+
+        for (uint32_t i = header->exactCount; i < header->exactCount + header->patternCount; i++)
+        {
+            if (entries[i].kind == kind)
+            {
+                result.push_back({string(key(entries[i])), string(image(entries[i]))});
+            }
+        }
+        return result;
+    }
+
+    /**
+     * @brief Whether the index was compiled from the current versions of the sources
+     */
+    bool upToDate(const vector<string> &sources) const
+    {
+        if (!loaded())
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < 2; i++)
+        {
+            int64_t mtime = i < sources.size() ? fileMtime(sources[i]) : 0;
+            if (mtime != header->sourceMtimes[i])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+/**
+ * @brief Reports changes to the asset source files through inotify
+ */
+struct AssetWatcher
+{
+    int fd = -1;
+
+    ~AssetWatcher()
+    {
+        if (fd != -1)
+        {
+            close(fd);
+        }
+    }
+
+    bool init(const vector<string> &sources)
+    {
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        bool watching = false;
+        for (const auto &source : sources)
+        {
+            string dir = fs::path(source).parent_path();
+            if (inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_ONLYDIR) != -1)
+            {
+                watching = true;
+            }
+        }
+        return watching;
+    }
+
+    /**
+     * @brief Read pending events
+     * @return true if one of them touched an asset file
+     */
+    bool changed()
+    {
+        alignas(struct inotify_event) char buf[4096];
+        bool touched = false;
+        ssize_t n;
+
+        while ((n = read(fd, buf, sizeof(buf))) > 0)
+        {
+            for (char *p = buf; p < buf + n;)
+            {
+                auto *event = (struct inotify_event *)p;
+                p += sizeof(struct inotify_event) + event->len;
+
+                if (event->len > 0 && strcmp(event->name, "assets") == 0)
+                {
+                    touched = true;
+                }
+            }
+        }
+        return touched;
+    }
+};
@@ -11,29 +11,28 @@
 #include <sys/un.h>
 
 
-// Discord RPC
+// Discord RPC, not needed when building with the native IPC client only
+#ifndef BRPC_NATIVE_IPC
 #include "../discord/discord.h"
+#endif
 
 // X11 libs
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 #include <X11/Xutil.h>
+#include <xcb/xcb.h>
 
 // variables
 #define VERSION "2.2.1"
 
 //local includes
 
-namespace
-{
-    volatile bool interrupted{false};
-}
 namespace fs = std::filesystem;
 using namespace std;
 
 int startTime;
 Display *disp;
-float mem = -1, cpu = -1;
+xcb_connection_t *xconn; // focus and WM queries, Xlib is only kept for the idle extensions
 string distro;
 static int trapped_error_code = 0;
 string wm;
@@ -53,6 +52,14 @@ map<string, string> aliases = {
     {"u?xterm", "xterm"}, {"vivaldi(-stable)?", "vivaldi"}
 };
 
+// Open all day, so never worth mentioning as a running app: the Discord clients (brpc waits for
+// one to start), browsers, terminals, file managers, chat and launchers
+vector<string> ambientApps = {
+    "chrome", "chromium", "discord", "discord-canary", "discord-ptb", "dolphin",
+    "firefox", "konsole", "lutris", "st", "steam", "surf", "telegram",
+    "vesktop", "vivaldi", "webcord", "xterm"
+};
+
 map<string, string> distros_lsb = {
     {"Arch|Artix", "archlinux"}, {"LinuxMint", "lmint"},
     {"Gentoo", "gentoo"}, {"Ubuntu", "ubuntu"},
@@ -77,9 +84,27 @@ string helpMsg =
     "  -k, --kill             Kill the currently running instance.\n"
     "  -f, --ignore-discord   Don't check for Discord on start.\n"
     "  --debug                Print debug messages.\n"
+    "  --log-level=warn       Log messages of this level and up (debug, info, warn, error), --debug implies debug.\n"
     "  --usage-sleep=5000     Sleep time in milliseconds between updating CPU and RAM usages.\n"
-    "  --update-sleep=100     Sleep time in milliseconds between updating the rich presence and focused application.\n"
+    "  --update-sleep=100     Ignored, the rich presence is updated on every new sample and focus change.\n"
     "  --no-small-image       Disable small image in the rich presence (focused application).\n"
+    "  --per-core             Sample every core, showing the hottest one in the rich presence and the stats.\n"
+    "  --running-apps         Mention the newest running app of the asset table that isn't focused, e.g. a game on another workspace.\n"
+    "  --running-app=IMAGE    Only mention apps with this image key as running, can be repeated, implies --running-apps.\n"
+    "  --app-usage            Show the CPU and memory usage of the focused application and its children.\n"
+    "  --show-title           Show the focused window's title when hovering the small image.\n"
+    "  --title-max-length=64  Cut titles longer than this many characters.\n"
+    "  --title-redact=REGEX   Replace the parts of titles matching REGEX with ***, can be repeated.\n"
+    "  --idle-timeout=300000  Time in milliseconds without input after which you count as idle, 0 to disable.\n"
+    "  --idle-sleep=60000     Sleep time in milliseconds between updating CPU and RAM usages while idle, 0 to stop.\n"
+    "  --idle-away            Show \"Away\" in the rich presence while idle.\n"
+    "  --native-ipc           Talk to Discord over its IPC socket directly instead of using the Game SDK.\n"
+    "  --compile-assets       Compile /etc/brpc/assets and ~/.config/brpc/assets into the asset index and exit.\n"
+    "  --record=FILE          Record the raw inputs (usage samples, focus changes) to FILE.\n"
+    "  --replay=FILE          Replay a recorded trace as fast as possible, printing the activities, and exit.\n"
+    "  --replay-null          Don't print the activities while replaying, for profiling.\n"
+    "  --stats                Print the counters and latencies of the running instance and exit.\n"
+    "  --startup-trace        Print how long each startup phase took once the first presence is out.\n"
     "\n"
     "  -h, --help             Display this help menu and exit.\n"
     "  -v, --version          Output version number and exit.\n"
@@ -87,24 +112,19 @@ string helpMsg =
     "========================================\n"
     "       Better-RPC++ Version " + std::string(VERSION) + "       \n"
     "========================================\n";
-// regular expressions
 
-regex memavailr("MemAvailable: +(\\d+) kB");
-regex memtotalr("MemTotal: +(\\d+) kB");
-regex processRegex("\\/proc\\/\\d+\\/cmdline");
-regex usageRegex("^usage-sleep=(\\d+)$");
-regex updateRegex("^update-sleep=(\\d+)$");
-
-vector<pair<regex, string>> aliases_regex = {};
-vector<pair<regex, string>> distros_lsb_regex = {};
-vector<pair<regex, string>> distros_os_regex = {};
 
+#ifndef BRPC_NATIVE_IPC
 struct DiscordState
 {
     discord::User currentUser;
 
     unique_ptr<discord::Core> core;
+
+    // Set from a callback when Discord is gone, the core can't be torn down from inside RunCallbacks
+    bool broken = false;
 };
+#endif
 
 struct DistroAsset
 {
@@ -122,11 +142,33 @@ struct Config
 {
     bool ignoreDiscord = false;
     bool debug = false;
+    string logLevel; // empty logs nothing unless debug is set
     int usageSleep = 5000;
     int updateSleep = 300;
     bool noSmallImage = false;
+    bool showTitle = false;
+    bool appUsage = false;
+    bool perCore = false;
+    bool runningApps = false;
+    vector<string> runningAppImages; // opt-in list, empty to take any app that isn't ambient
+    int titleMaxLength = 64;
+    vector<regex> titleRedact;
+    int idleTimeout = 300000; // 0 disables idle detection
+    int idleSleep = 60000;    // 0 stops sampling while idle
+    bool idleAway = false;
     bool printHelp = false;
     bool printVersion = false;
+    bool compileAssets = false;
+    bool printStats = false;
+    bool startupTrace = false;
+    string recordPath;
+    string replayPath;
+    bool replayNull = false;
+#ifdef BRPC_NATIVE_IPC
+    bool nativeIpc = true;
+#else
+    bool nativeIpc = false;
+#endif
 };
 
 Config config;
@@ -134,7 +176,47 @@ Config config;
 // local imports
 
 #include "logging.hpp"
+#include "reactor.hpp"
+#include "stats.hpp"
+#include "procfs.hpp"
+#include "metrics.hpp"
+#include "procscan.hpp"
+#include "procsample.hpp"
+#include "proctable.hpp"
+#include "cpucores.hpp"
+#include "matcher.hpp"
+#include "assets.hpp"
+#include "startup.hpp"
 #include "wm.hpp"
+#include "focus.hpp"
+#include "idle.hpp"
+#include "compositor.hpp"
+#include "hyprland.hpp"
+#include "json.hpp"
+#include "sway.hpp"
+#include "niri.hpp"
+#include "discordwatch.hpp"
+#include "publisher.hpp"
+#include "discordipc.hpp"
+#include "connection.hpp"
+
+XcbAtoms atoms;
+X11FocusWatcher focusWatcher;
+X11IdleWatcher idleWatcher;
+HyprlandEvents hyprland;
+SwayEvents sway;
+NiriEvents niri;
+// Focus comes from here instead of X when running under a compositor we speak the IPC of
+CompositorBackend *compositor = nullptr;
+// Whichever backend detects idleness in this session, nullptr if there is none
+IdleBackend *idleBackend = nullptr;
+ActivityPublisher publisher;
+
+AssetMatcher windowMatcher;
+AssetMatcher distroMatcher;
+unique_ptr<AssetIndex> assetIndex = make_unique<AssetIndex>();
+// Raw window class -> resolved asset, windows get focused over and over again
+LruCache<string, WindowAsset> windowAssetCache(64);
 
 // methods
 
@@ -154,50 +236,52 @@ string lower(string s)
 
 double ms_uptime(void)
 {
-    FILE *in = fopen("/proc/uptime", "r");
-    double retval = 0;
-    char tmp[256] = {0x0};
-    if (in != NULL)
+    char buf[128];
+    if (procUptime.read(buf, sizeof(buf)) <= 0)
     {
-        fgets(tmp, sizeof(tmp), in);
-        retval = atof(tmp);
-        fclose(in);
+        return 0;
     }
-    return retval;
+
+    const char *p = buf;
+    return scanDecimal(p);
 }
 
-float getRAM()
+struct MemInfo
 {
-    ifstream meminfo;
-    meminfo.open("/proc/meminfo");
-
-    long total = 0;
-    long available = 0;
-
-    smatch matcher;
-    string line;
+    unsigned long long total = 0;
+    unsigned long long available = 0;
 
-    while (getline(meminfo, line))
+    float percent() const
     {
-        if (regex_search(line, matcher, memavailr))
+        if (total == 0)
         {
-            available = stoi(matcher[1]);
-        }
-        else if (regex_search(line, matcher, memtotalr))
-        {
-            total = stoi(matcher[1]);
+            return 0;
         }
+        return (float)(total - available) / total * 100;
     }
+};
 
-    meminfo.close();
-
-    if (total == 0)
+bool readMemInfo(MemInfo &info)
+{
+    char buf[4096];
+    if (procMeminfo.read(buf, sizeof(buf)) <= 0)
     {
-        return 0;
+        return false;
     }
-    return (float)(total - available) / total * 100;
+
+    info.total = scanKey(buf, "MemTotal:");
+    info.available = scanKey(buf, "MemAvailable:");
+    return true;
+}
+
+float getRAM()
+{
+    MemInfo info;
+    readMemInfo(info);
+    return info.percent();
 }
 
+#ifndef BRPC_NATIVE_IPC
 void setActivity(DiscordState &state, string details, string sstate, string smallimage, string smallimagetext, string largeimage, string largeimagetext, long uptime, discord::ActivityType type)
 {
     time_t now = time(nullptr);
@@ -211,206 +295,253 @@ void setActivity(DiscordState &state, string details, string sstate, string smal
     activity.GetTimestamps().SetStart(uptime);
     activity.SetType(type);
 
-    state.core->ActivityManager().UpdateActivity(activity, [](discord::Result result)
-                                                 { if(config.debug) log(string((result == discord::Result::Ok) ? "Succeeded" : "Failed")  + " updating activity!", LogType::DEBUG); });
+    publisher.inFlight++;
+    state.core->ActivityManager().UpdateActivity(activity, [&state](discord::Result result)
+                                                 {
+                                                     publisher.inFlight--;
+                                                     if (result == discord::Result::Ok)
+                                                     {
+                                                         LOG("Succeeded updating activity!", LogType::DEBUG);
+                                                         return;
+                                                     }
+                                                     publisher.failed++;
+                                                     publisher.resend = true;
+                                                     LOG("Failed updating activity! (err " + to_string(static_cast<int>(result)) + ")", LogType::WARN);
+                                                     if (result == discord::Result::NotRunning || result == discord::Result::ServiceUnavailable)
+                                                     {
+                                                         state.broken = true;
+                                                     }
+                                                 });
 }
 
-string getHyprlandSocketPath()
+void setActivity(DiscordState &state, const ActivityPayload &payload)
 {
-    const char *xdgRuntimeDir = getenv("XDG_RUNTIME_DIR");
-    const char *hyprlandSignature = getenv("HYPRLAND_INSTANCE_SIGNATURE");
+    setActivity(state, payload.details, payload.state, payload.smallImage, payload.smallText,
+                payload.largeImage, payload.largeText, payload.start, static_cast<discord::ActivityType>(payload.type));
+}
+#endif
 
-    if (!xdgRuntimeDir || !hyprlandSignature)
+/**
+ * @brief Pick the compositor backend from the environment the session exported
+ * @return nullptr on X11 and on compositors without a backend
+ */
+CompositorBackend *detectCompositor()
+{
+    if (getenv("HYPRLAND_INSTANCE_SIGNATURE"))
     {
-        log("Hyprland environment variables are not set. Ensure Hyprland is running.", LogType::ERROR);
-        return "";
+        return &hyprland;
     }
-
-    // Construct the socket path
-    string socketPath = string(xdgRuntimeDir) + "/hypr/" + string(hyprlandSignature) + "/.socket2.sock";
-
-    // Check if the socket exists
-    if (!std::filesystem::exists(socketPath))
+    if (getenv("NIRI_SOCKET"))
     {
-        log("Hyprland IPC socket not found at: " + socketPath, LogType::ERROR);
-        return "";
+        return &niri;
     }
-
-    return socketPath;
+    // i3 exports I3SOCK too, but on X the X11 watcher also gets idle detection
+    if (getenv("SWAYSOCK"))
+    {
+        return &sway;
+    }
+    return nullptr;
 }
 
-string getActiveWindowClassName(Display *disp)
+string getActiveWindowClassName()
 {
-    // Check if Hyprland is running
-    const char *xdgRuntimeDir = getenv("XDG_RUNTIME_DIR");
-    const char *hyprlandSignature = getenv("HYPRLAND_INSTANCE_SIGNATURE");
-
-    if (xdgRuntimeDir && hyprlandSignature)
+    if (compositor)
     {
-        // Use Hyprland-specific logic
-        string socketPath = string(xdgRuntimeDir) + "/hypr/" + string(hyprlandSignature) + "/.socket2.sock";
+        compositor->dispatch();
+        return compositor->activeClass;
+    }
 
-        if (std::filesystem::exists(socketPath))
-        {
-            int sock = socket(AF_UNIX, SOCK_STREAM, 0);
-            if (sock == -1)
-            {
-                log("Failed to create socket for Hyprland IPC", LogType::ERROR);
-                return "";
-            }
+    // Fallback to X11 for other environments, XWayland windows only on other Wayland compositors
+    focusWatcher.dispatch();
+    return focusWatcher.activeClass;
+}
 
-            struct sockaddr_un addr;
-            memset(&addr, 0, sizeof(addr));
-            addr.sun_family = AF_UNIX;
-            strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+/**
+ * @brief Process owning the focused window, as of the last getActiveWindowClassName()
+ * @return 0 if unknown
+ */
+int getActiveWindowPid()
+{
+    return compositor ? compositor->activePid : focusWatcher.activePid;
+}
 
-            if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1)
-            {
-                log("Failed to connect to Hyprland IPC socket", LogType::ERROR);
-                close(sock);
-                return "";
-            }
+/**
+ * @brief Title of the focused window, as of the last getActiveWindowClassName()
+ */
+string getActiveWindowTitle()
+{
+    return compositor ? compositor->activeTitle : focusWatcher.activeTitle;
+}
 
-            // Send the "activewindow" command
-            string command = "activewindow";
-            if (send(sock, command.c_str(), command.size(), 0) == -1)
-            {
-                log("Failed to send command to Hyprland IPC socket", LogType::ERROR);
-                close(sock);
-                return "";
-            }
+/**
+ * @brief Cut s to at most maxChars UTF-8 characters, marking the cut with an ellipsis
+ */
+string truncateUtf8(const string &s, size_t maxChars)
+{
+    size_t chars = 0;
+    size_t cut = 0; // where the ellipsis goes, it takes the place of the last character kept
 
-            char buffer[8192];
-            ssize_t bytesRead = recv(sock, buffer, sizeof(buffer) - 1, 0);
-            if (bytesRead <= 0)
-            {
-                log("Failed to read response from Hyprland IPC socket", LogType::ERROR);
-                close(sock);
-                return "";
-            }
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        // Continuation bytes don't start a character
+        if (((unsigned char)s[i] & 0xC0) == 0x80)
+        {
+            continue;
+        }
+        if (chars == maxChars - 1)
+        {
+            cut = i;
+        }
+        if (chars++ == maxChars)
+        {
+            return maxChars == 0 ? "" : s.substr(0, cut) + "\u2026";
+        }
+    }
+    return s;
+}
 
-            buffer[bytesRead] = '\0';
-            string response = buffer;
-            log("Hyprland IPC raw response: " + response, LogType::DEBUG);
-            close(sock);
+/**
+ * @brief Apply the redaction rules and length limit to a window title
+ */
+string formatTitle(string title)
+{
+    for (const auto &pattern : config.titleRedact)
+    {
+        title = regex_replace(title, pattern, "***");
+    }
+    return truncateUtf8(title, config.titleMaxLength);
+}
+/**
+ * @brief Jiffies of the aggregate cpu line of /proc/stat
+ */
+struct CpuTimes
+{
+    // user nice system idle iowait irq softirq steal guest guest_nice
+    unsigned long long columns[10] = {};
 
-            // Parse the response to extract the active window class name
-            size_t startPos = response.find("activewindow>>");
-            if (startPos != string::npos)
-            {
-                startPos += 14;
-                size_t endPos = response.find(",", startPos);
-                if (endPos != string::npos)
-                {
-                    string windowClass = response.substr(startPos, endPos - startPos);
-                    log("Active window class: " + windowClass, LogType::DEBUG);
-                    return windowClass;
-                }
-            }
+    unsigned long long idle() const
+    {
+        return columns[3] + columns[4];
+    }
 
-            log("No active window found in Hyprland response", LogType::DEBUG);
-            return "";
+    /**
+     * guest and guest_nice are already accounted in user and nice, so they are left out
+     */
+    unsigned long long total() const
+    {
+        unsigned long long sum = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            sum += columns[i];
         }
+        return sum;
     }
+};
 
-    // Fallback to X11 for non-Hyprland environments
-    Window root = XDefaultRootWindow(disp);
-
-    char prop[256];
-    get_property(disp, root, XA_WINDOW, "_NET_ACTIVE_WINDOW", prop, sizeof(prop));
+/**
+ * @brief Computes CPU utilisation from two consecutive reads of /proc/stat.
+ * Keeps the previous snapshot, so it never has to sleep and can be sampled at any cadence.
+ */
+struct CpuSampler
+{
+    CpuTimes last;
+    bool primed = false;
+    double percent = 0;
 
-    if (prop[0] == '\0')
+    static bool read(CpuTimes &times)
     {
-        return "";
+        // The aggregate line comes first, no need to pull in the per-core lines
+        char buf[512];
+        if (procStat.read(buf, sizeof(buf)) <= 0)
+        {
+            return false;
+        }
+        return parse(buf, times);
     }
 
-    XClassHint hint;
-    int hintStatus = XGetClassHint(disp, *((Window *)prop), &hint);
+    /**
+     * @brief Parse the aggregate line out of /proc/stat content that was already read
+     */
+    static bool parse(const char *buf, CpuTimes &times)
+    {
+        const char *p = findLine(buf, "cpu ");
+        if (!p)
+        {
+            return false;
+        }
 
-    if (hintStatus == 0)
+        // Old kernels have fewer columns, the missing ones stay zero
+        for (int i = 0; i < 10; i++)
+        {
+            times.columns[i] = scanNumber(p);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Utilisation since the previous call.
+     * The first call reports the average since boot, so there is a value right away.
+     */
+    double sample()
     {
-        return "";
+        CpuTimes now;
+        if (!read(now))
+        {
+            return percent;
+        }
+        return sample(now);
     }
 
-    XFree(hint.res_name);
-    string s(hint.res_class);
-    XFree(hint.res_class);
+    /**
+     * @brief Same as above, for a snapshot that was already read (or replayed from a trace)
+     */
+    double sample(const CpuTimes &now)
+    {
+        unsigned long long total = now.total();
+        unsigned long long idle = now.idle();
 
-    return s;
-}
-static unsigned long long lastTotalUser, lastTotalUserLow, lastTotalSys, lastTotalIdle;
+        if (primed)
+        {
+            unsigned long long lastTotal = last.total();
+            unsigned long long lastIdle = last.idle();
 
-void getLast()
-{
-    FILE *file = fopen("/proc/stat", "r");
-    fscanf(file, "cpu %llu %llu %llu %llu", &lastTotalUser, &lastTotalUserLow,
-           &lastTotalSys, &lastTotalIdle);
-    fclose(file);
-}
+            if (total < lastTotal || idle < lastIdle)
+            {
+                // Counters went backwards (overflow or hotplug), start over from this snapshot
+                last = now;
+                return percent;
+            }
 
-double getCPU()
-{
-    getLast();
-    sleep(1);
-    double percent;
-    FILE *file;
-    unsigned long long totalUser, totalUserLow, totalSys, totalIdle, total;
+            total -= lastTotal;
+            idle -= lastIdle;
+        }
 
-    file = fopen("/proc/stat", "r");
-    fscanf(file, "cpu %llu %llu %llu %llu", &totalUser, &totalUserLow,
-           &totalSys, &totalIdle);
-    fclose(file);
+        if (total > 0)
+        {
+            percent = (double)(total - idle) / total * 100;
+        }
 
-    if (totalUser < lastTotalUser || totalUserLow < lastTotalUserLow ||
-        totalSys < lastTotalSys || totalIdle < lastTotalIdle)
-    {
-        // Overflow detection. Just skip this value.
-        percent = -1.0;
-    }
-    else
-    {
-        total = (totalUser - lastTotalUser) + (totalUserLow - lastTotalUserLow) +
-                (totalSys - lastTotalSys);
-        percent = total;
-        total += (totalIdle - lastTotalIdle);
-        percent /= total;
-        percent *= 100;
+        last = now;
+        primed = true;
+        return percent;
     }
+};
 
-    lastTotalUser = totalUser;
-    lastTotalUserLow = totalUserLow;
-    lastTotalSys = totalSys;
-    lastTotalIdle = totalIdle;
+CpuSampler cpuSampler;
+CoreSampler coreSampler;
+MetricsChannel metrics;
 
-    return percent;
+double getCPU()
+{
+    return cpuSampler.sample();
 }
 
 bool processRunning(string name, bool ignoreCase = true)
 {
-    string strReg = name; // Match the name anywhere
-    regex nameRegex(ignoreCase ? regex(strReg, regex::icase) : regex(strReg));
-    log("Checking for process: " + name, LogType::DEBUG);
-
-    for (const auto &entry : fs::directory_iterator("/proc"))
-    {
-        if (fs::is_directory(entry.path()))
-        {
-            ifstream s(entry.path() / "cmdline");
-            if (s.is_open())
-            {
-                string line((istreambuf_iterator<char>(s)), istreambuf_iterator<char>());
-                replace(line.begin(), line.end(), '\0', ' '); // Replace null characters with spaces
-                log("Cmdline content for PID " + entry.path().filename().string() + ": " + line, LogType::DEBUG); // Log the cmdline content
-                if (regex_search(line, nameRegex))
-                {
-                    log("Found process: " + name + " (cmdline: " + line + ")", LogType::DEBUG);
-                    return true;
-                }
-            }
-        }
-    }
-    log("Process not found: " + name, LogType::DEBUG);
-    return false;
+    ProcessScanner scanner({name}, ignoreCase);
+    bool found = scanner.scanFound()[0];
+    LOG(string(found ? "Found" : "Did not find") + " process: " + name, LogType::DEBUG);
+    return found;
 }
 
 bool in_array(const string &value, const vector<string> &array)
@@ -418,9 +549,24 @@ bool in_array(const string &value, const vector<string> &array)
     return find(array.begin(), array.end(), value) != array.end();
 }
 
+/**
+ * @brief Parse a "name=<digits>" option
+ * @param name Option name including the '='
+ */
+bool parseNumberOption(const string &s, const char *name, int &value)
+{
+    size_t len = strlen(name);
+    if (s.compare(0, len, name) != 0 || s.size() == len || s.find_first_not_of("0123456789", len) != string::npos)
+    {
+        return false;
+    }
+
+    value = stoi(s.substr(len));
+    return true;
+}
+
 void parseConfigOption(Config *config, char *option, bool arg)
 {
-    smatch matcher;
     string s = option;
 
     if (arg)
@@ -443,6 +589,42 @@ void parseConfigOption(Config *config, char *option, bool arg)
             return;
         }
 
+        if (s == "--compile-assets")
+        {
+            config->compileAssets = true;
+            return;
+        }
+
+        if (s.rfind("--record=", 0) == 0)
+        {
+            config->recordPath = s.substr(9);
+            return;
+        }
+
+        if (s.rfind("--replay=", 0) == 0)
+        {
+            config->replayPath = s.substr(9);
+            return;
+        }
+
+        if (s == "--replay-null")
+        {
+            config->replayNull = true;
+            return;
+        }
+
+        if (s == "--stats")
+        {
+            config->printStats = true;
+            return;
+        }
+
+        if (s == "--startup-trace")
+        {
+            config->startupTrace = true;
+            return;
+        }
+
         if (!strncmp(option, "--", 2))
         {
             s = s.substr(2, s.size() - 2);
@@ -461,15 +643,79 @@ void parseConfigOption(Config *config, char *option, bool arg)
         return;
     }
 
-    if (regex_search(s, matcher, usageRegex))
+    if (s == "native-ipc")
+    {
+        config->nativeIpc = true;
+        return;
+    }
+
+    if (s == "per-core")
+    {
+        config->perCore = true;
+        return;
+    }
+
+    if (s == "running-apps")
+    {
+        config->runningApps = true;
+        return;
+    }
+
+    if (s.rfind("running-app=", 0) == 0)
+    {
+        config->runningApps = true;
+        config->runningAppImages.push_back(s.substr(12));
+        return;
+    }
+
+    if (s == "app-usage")
+    {
+        config->appUsage = true;
+        return;
+    }
+
+    if (s == "show-title")
     {
-        config->usageSleep = stoi(matcher[1]);
+        config->showTitle = true;
+        return;
+    }
+
+    if (s.rfind("title-redact=", 0) == 0)
+    {
+        try
+        {
+            config->titleRedact.emplace_back(s.substr(13), regex::icase);
+        }
+        catch (regex_error &ex)
+        {
+            LOG("Invalid title-redact pattern " + s.substr(13) + ": " + ex.what(), LogType::WARN);
+        }
         return;
     }
 
-    if (regex_search(s, matcher, updateRegex))
+    if (s == "idle-away")
     {
-        config->updateSleep = stoi(matcher[1]);
+        config->idleAway = true;
+        return;
+    }
+
+    // Plain prefix checks, compiling a regex per option cost more than the rest of the startup
+    if (parseNumberOption(s, "usage-sleep=", config->usageSleep) ||
+        parseNumberOption(s, "update-sleep=", config->updateSleep) ||
+        parseNumberOption(s, "idle-timeout=", config->idleTimeout) ||
+        parseNumberOption(s, "idle-sleep=", config->idleSleep) ||
+        parseNumberOption(s, "title-max-length=", config->titleMaxLength))
+    {
+        return;
+    }
+
+    if (s.rfind("log-level=", 0) == 0)
+    {
+        string level = s.substr(10);
+        if (level == "debug" || level == "info" || level == "warn" || level == "error")
+        {
+            config->logLevel = level;
+        }
         return;
     }
 }
@@ -522,67 +768,79 @@ string getDistro()
     string distro = "";
     string line;
     ifstream release;
-    regex distroreg;
-    smatch distromatcher;
+    string key;
 
     if (fs::exists("/etc/lsb-release"))
     {
-        distroreg = regex("DISTRIB_ID=\"?([a-zA-Z0-9 ]+)\"?");
+        key = "DISTRIB_ID=";
         release.open("/etc/lsb-release");
     }
     else if (fs::exists("/etc/os-release"))
     {
-        distroreg = regex("NAME=\"?([a-zA-Z0-9 ]+)\"?");
+        key = "NAME=";
         release.open("/etc/os-release");
     }
     else
     {
-        log("Warning: Neither /etc/lsb-release nor /etc/os-release was found. Please install lsb_release or ask your distribution's developer to support os-release.", LogType::DEBUG);
+        LOG("Warning: Neither /etc/lsb-release nor /etc/os-release was found. Please install lsb_release or ask your distribution's developer to support os-release.", LogType::DEBUG);
         return "Linux";
     }
 
-    while (getline(release, line))
+    // The first KEY="Name" with a name made of letters, digits and spaces, the value is cut at anything else
+    while (getline(release, line) && distro.empty())
     {
-        if (regex_search(line, distromatcher, distroreg))
+        for (size_t pos = line.find(key); pos != string::npos && distro.empty(); pos = line.find(key, pos + 1))
         {
-            distro = distromatcher[1];
-            break;
+            size_t start = pos + key.size();
+            if (start < line.size() && line[start] == '"')
+            {
+                start++;
+            }
+
+            size_t end = start;
+            while (end < line.size() && (isalnum((unsigned char)line[end]) || line[end] == ' '))
+            {
+                end++;
+            }
+            distro = line.substr(start, end - start);
         }
     }
 
     return distro;
 }
 
+/**
+ * @brief getDistro(), only parsing the release files again when they changed
+ */
+string getCachedDistro()
+{
+    ProbeCache cache(probeCachePath());
+    string result = cache.get("distro", {"/etc/lsb-release", "/etc/os-release"}, getDistro);
+    cache.save();
+    return result;
+}
+
 WindowAsset getWindowAsset(string w)
 {
     WindowAsset window{};
+    if (windowAssetCache.get(w, window))
+    {
+        return window;
+    }
+
     window.text = w;
     if (w == "")
     {
         window.image = "";
         return window;
     }
-    window.image = "file";
-    w = lower(w);
 
-    if (in_array(w, apps))
-    {
-        window.image = w;
-    }
-    else
+    if (!windowMatcher.match(lower(w), window.image))
     {
-        for (const auto &kv : aliases_regex)
-        {
-            regex r = kv.first;
-            smatch m;
-            if (regex_match(w, m, r))
-            {
-                window.image = kv.second;
-                break;
-            }
-        }
+        window.image = "file";
     }
 
+    windowAssetCache.put(w, window);
     return window;
 }
 
@@ -590,54 +848,86 @@ DistroAsset getDistroAsset(string d)
 {
     DistroAsset dist{};
     dist.text = d + " / Better-RPC++ " + VERSION;
-    dist.image = "tux";
 
-    for (const auto &kv : distros_lsb_regex)
+    if (!distroMatcher.match(d, dist.image))
     {
-        regex r = kv.first;
-        smatch m;
-        if (regex_match(d, m, r))
-        {
-            dist.image = kv.second;
-            break;
-        }
+        dist.image = "tux";
     }
-    if (dist.image == "tux")
+
+    return dist;
+}
+
+/**
+ * @brief Map the asset index, compiling it first if the sources changed since
+ */
+void loadAssetIndex()
+{
+    vector<string> sources = assetSourcePaths();
+    string indexPath = assetIndexPath();
+    auto index = make_unique<AssetIndex>();
+
+    bool haveSources = false;
+    for (const auto &source : sources)
     {
-        for (const auto &kv : distros_os_regex)
+        haveSources = haveSources || fileMtime(source) != 0;
+    }
+
+    if (!indexPath.empty() && haveSources)
+    {
+        if (!index->load(indexPath) || !index->upToDate(sources))
         {
-            regex r = kv.first;
-            smatch m;
-            if (regex_match(d, m, r))
+            if (compileAssetIndex(sources, indexPath))
             {
-                dist.image = kv.second;
-                break;
+                index->load(indexPath);
             }
         }
     }
 
-    return dist;
+    assetIndex.swap(index);
 }
 
 /**
- * @brief Compile strings to regular expressions
+ * @brief Build the matchers from the asset index and the built-in tables.
+ * The new matchers replace the old ones in one go, so this can also be used to reload.
+ * Their patterns are only compiled on the first name that no exact rule resolves.
  */
-void compileRegexes(map<string, string> *from, vector<pair<regex, string>> *to, bool ignoreCase)
+void buildMatchers()
 {
+    loadAssetIndex();
 
-    for (const auto &kv : *from)
+    AssetMatcher windows;
+    windows.lookup = [](const string &name, string &value)
+    { return assetIndex->lookup(ASSET_APP, name, value); };
+    for (const auto &app : apps)
     {
-        const regex r = regex(kv.first);
-        to->push_back({r, kv.second});
+        windows.addExact(app, app);
+    }
+    // User defined patterns win over the built-in ones
+    for (const auto &kv : assetIndex->patterns(ASSET_ALIAS))
+    {
+        windows.addPattern(kv.first, kv.second);
+    }
+    for (const auto &kv : aliases)
+    {
+        windows.addPattern(kv.first, kv.second);
     }
-}
 
-/**
- * @brief Compile all strings to regular expressions
- */
-void compileAllRegexes()
-{
-    compileRegexes(&aliases, &aliases_regex, false);
-    compileRegexes(&distros_lsb, &distros_lsb_regex, true);
-    compileRegexes(&distros_os, &distros_os_regex, true);
+    AssetMatcher distros;
+    for (const auto &kv : assetIndex->patterns(ASSET_DISTRO))
+    {
+        distros.addPattern(kv.first, kv.second);
+    }
+    // lsb-release names take precedence over os-release names
+    for (const auto &kv : distros_lsb)
+    {
+        distros.addPattern(kv.first, kv.second);
+    }
+    for (const auto &kv : distros_os)
+    {
+        distros.addPattern(kv.first, kv.second);
+    }
+
+    windowMatcher = move(windows);
+    distroMatcher = move(distros);
+    windowAssetCache.clear();
 }
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <functional>
+#include <fcntl.h>
+
+/**
+ * @brief Connect a unix stream socket to the given path
+ * @return The socket, or -1 on error
+ */
+int connectUnixSocket(const string &path, bool nonBlocking)
+{
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+    {
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        close(sock);
+        return -1;
+    }
+
+    if (nonBlocking)
+    {
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    }
+
+    return sock;
+}
+
+/**
+ * @brief Focus tracking through a Wayland compositor's own IPC.
+ * Every backend keeps an event subscription open on fd and only updates the active
+ * window from what the compositor pushes, so nothing is polled while focus doesn't change.
+ */
+struct CompositorBackend
+{
+    int fd = -1;
+    bool enabled = false;
+    // Successful subscriptions, a new socket usually gets the number of the one it replaces
+    unsigned long connections = 0;
+
+    string activeClass;
+    string activeTitle;
+    int activePid = 0;
+
+    // Report title changes of the focused window from dispatch()
+    bool watchTitle = false;
+    // Resolve the pid of focused windows, for backends where it costs an extra request
+    bool watchPid = false;
+
+    int backoffMs = 0;
+    long nextAttemptNs = 0;
+    // Armed for nextAttemptNs while the socket is down, call reconnect() when it fires
+    Timer retryTimer;
+
+    static constexpr int minBackoffMs = 250;
+    static constexpr int maxBackoffMs = 30000;
+
+    virtual ~CompositorBackend()
+    {
+        disconnect();
+    }
+
+    virtual const char *name() const = 0;
+
+    /**
+     * @brief Open the event stream on fd and read the window that is focused right now
+     * @return false if the compositor can't be reached
+     */
+    virtual bool subscribe() = 0;
+
+    /**
+     * @brief Read whatever the compositor has sent without blocking
+     * @return true if the focused window's class changed, or its title if watchTitle is set
+     */
+    virtual bool dispatch() = 0;
+
+    void init()
+    {
+        enabled = true;
+        reconnect();
+    }
+
+    bool reconnect()
+    {
+        long now = Timer::nowNs();
+        if (now < nextAttemptNs)
+        {
+            return false;
+        }
+
+        disconnect();
+        if (!subscribe())
+        {
+            disconnect();
+            backoffMs = backoffMs == 0 ? minBackoffMs : min(backoffMs * 2, maxBackoffMs);
+            nextAttemptNs = now + backoffMs * 1000000L;
+            retryTimer.arm(nextAttemptNs);
+            LOG(string("Failed to subscribe to ") + name() + " events, retrying in " + to_string(backoffMs) + "ms", LogType::ERROR);
+            return false;
+        }
+
+        LOG(string("Subscribed to ") + name() + " events", LogType::DEBUG);
+        connections++;
+        backoffMs = 0;
+        retryTimer.disarm();
+        return true;
+    }
+
+    void disconnect()
+    {
+        if (fd != -1)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    /**
+     * @brief Append everything that can be read without blocking to in
+     * @return false if the connection was lost
+     */
+    bool receive(string &in)
+    {
+        char chunk[4096];
+        while (true)
+        {
+            ssize_t n = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+            if (n > 0)
+            {
+                in.append(chunk, n);
+                continue;
+            }
+
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                return true;
+            }
+            if (n == -1 && errno == EINTR)
+            {
+                continue;
+            }
+
+            LOG(string("Lost connection to ") + name() + " IPC socket", LogType::ERROR);
+            return false;
+        }
+    }
+
+    /**
+     * @brief Blocking read of exactly size bytes from a request socket, which has a timeout set
+     */
+    static bool readExactly(int sock, char *buf, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t n = recv(sock, buf, size, 0);
+            if (n <= 0)
+            {
+                if (n == -1 && errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            buf += n;
+            size -= n;
+        }
+        return true;
+    }
+};
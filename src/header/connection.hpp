@@ -0,0 +1,195 @@
+#pragma once
+
+enum class ConnectionState
+{
+    Waiting,    // no Discord to connect to, woken up by its IPC socket appearing
+    Connecting, // transport opened, waiting for it to become ready
+    Ready,      // activities go through
+    Backoff     // an attempt failed, retried after a growing delay
+};
+
+/**
+ * @brief Keeps the connection to Discord alive across restarts of the client.
+ * The transport (Game SDK or native IPC) plugs in through open and close and reports back
+ * with ready() and lost(). Once it's ready again the last activity is replayed, so the
+ * presence comes back as soon as Discord does.
+ */
+struct DiscordConnection
+{
+    // Start connecting, false if that failed right away. May call ready() before returning.
+    function<bool()> open;
+    // Tear the transport down, nothing of it may be used afterwards
+    function<void()> close;
+    function<void()> onReady;
+
+    ConnectionState state = ConnectionState::Waiting;
+    Timer timer; // backoff delay, connect timeout and the slow poll while waiting
+    DiscordReadinessWatcher watcher;
+    bool watching = false;
+
+    int backoffMs = 0;
+    long readyNs = 0;
+    long lostNs = 0; // when the connection went down, until it's ready again
+    unsigned long attempts = 0;
+    unsigned long reconnects = 0;
+
+    static constexpr int minBackoffMs = 50;
+    static constexpr int maxBackoffMs = 10000;
+    static constexpr int connectTimeoutMs = 5000;
+    // Connections that broke sooner than this count as failed attempts, not as a restart of Discord
+    static constexpr int stableMs = 1000;
+    // inotify catches new sockets, this is only for clients that put theirs somewhere we don't watch
+    static constexpr int waitPollMs = 5000;
+
+    void init(Reactor &reactor)
+    {
+        reactor.add(timer, [this]()
+                    { onTimer(); });
+
+        watching = watcher.init();
+        if (watching)
+        {
+            reactor.add(watcher.fd, [this](uint32_t)
+                        {
+                            // Only acted on while waiting, but the queue has to be drained anyway
+                            if (watcher.drain() && state == ConnectionState::Waiting)
+                            {
+                                LOG("Discord IPC socket appeared", LogType::DEBUG);
+                                // It's created before Discord listens on it, the backoff covers the gap
+                                retry(minBackoffMs);
+                            }
+                        });
+        }
+    }
+
+    bool isReady() const
+    {
+        return state == ConnectionState::Ready;
+    }
+
+    void connect()
+    {
+        if (findDiscordIpcSocket().empty())
+        {
+            wait();
+            return;
+        }
+
+        attempts++;
+        state = ConnectionState::Connecting;
+        if (!open())
+        {
+            close();
+            retry(nextBackoff());
+            return;
+        }
+
+        if (state == ConnectionState::Connecting)
+        {
+            timer.arm(Timer::nowNs() + connectTimeoutMs * 1000000L);
+        }
+    }
+
+    /**
+     * @brief Reported by the transport once activities can be sent
+     */
+    void ready()
+    {
+        state = ConnectionState::Ready;
+        readyNs = Timer::nowNs();
+        timer.disarm();
+
+        if (lostNs)
+        {
+            reconnects++;
+            stats.reconnect.record(Timer::nowNs() - lostNs);
+            LOG("Reconnected to Discord after " + to_string((Timer::nowNs() - lostNs) / 1000000) + " ms", LogType::INFO);
+            lostNs = 0;
+        }
+        else
+        {
+            LOG("Connected to Discord.", LogType::INFO);
+        }
+
+        if (onReady)
+        {
+            onReady();
+        }
+    }
+
+    /**
+     * @brief Reported by the transport when the connection broke
+     */
+    void lost(const string &reason)
+    {
+        if (state != ConnectionState::Ready && state != ConnectionState::Connecting)
+        {
+            return;
+        }
+
+        LOG("Lost the connection to Discord: " + reason, LogType::WARN);
+        long now = Timer::nowNs();
+        bool stable = state == ConnectionState::Ready && now - readyNs >= stableMs * 1000000L;
+        if (state == ConnectionState::Ready && !lostNs)
+        {
+            lostNs = now;
+        }
+        close();
+
+        // After a working connection try again right away, if Discord is still on its way down the backoff takes over
+        if (stable)
+        {
+            backoffMs = 0;
+        }
+        retry(stable ? 0 : nextBackoff());
+    }
+
+    /**
+     * @brief Try again after delayMs, 0 for right away
+     */
+    void retry(int delayMs)
+    {
+        state = ConnectionState::Backoff;
+        timer.arm(Timer::nowNs() + max(delayMs, 1) * 1000000L);
+    }
+
+    int nextBackoff()
+    {
+        backoffMs = backoffMs ? min(backoffMs * 2, maxBackoffMs) : minBackoffMs;
+        return backoffMs;
+    }
+
+    void wait()
+    {
+        if (state != ConnectionState::Waiting)
+        {
+            LOG("Waiting for Discord to come back", LogType::INFO);
+        }
+        state = ConnectionState::Waiting;
+        backoffMs = 0;
+        timer.arm(Timer::nowNs() + waitPollMs * 1000000L);
+    }
+
+    void onTimer()
+    {
+        switch (state)
+        {
+        case ConnectionState::Connecting:
+            lost("no answer within " + to_string(connectTimeoutMs) + " ms");
+            break;
+        case ConnectionState::Waiting:
+        case ConnectionState::Backoff:
+            connect();
+            break;
+        case ConnectionState::Ready:
+            break;
+        }
+    }
+
+    string summary() const
+    {
+        static const char *names[] = {"waiting", "connecting", "ready", "backoff"};
+        return string("state=") + names[(int)state] + " attempts=" + to_string(attempts) +
+               " reconnects=" + to_string(reconnects);
+    }
+};
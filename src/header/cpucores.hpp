@@ -0,0 +1,242 @@
+#pragma once
+
+#include <cstdint>
+
+// The percentage kernel gets an AVX2 build next to the baseline one, picked at load time
+#if defined(__x86_64__) && defined(__GNUC__)
+#define BRPC_SIMD_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define BRPC_SIMD_CLONES
+#endif
+
+typedef uint64_t u64x4 __attribute__((vector_size(32)));
+typedef double f64x4 __attribute__((vector_size(32)));
+typedef float f32x4 __attribute__((vector_size(16)));
+
+/**
+ * @brief Busy percentage of every core from two snapshots of its total and idle jiffies.
+ * Cores with nothing to compare against must have their last values equal to the current ones,
+ * they come out as 0.
+ */
+BRPC_SIMD_CLONES
+void corePercentages(const uint64_t *total, const uint64_t *idle,
+                     const uint64_t *lastTotal, const uint64_t *lastIdle,
+                     float *percent, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        u64x4 t, id, lt, li;
+        memcpy(&t, total + i, sizeof(t));
+        memcpy(&id, idle + i, sizeof(id));
+        memcpy(&lt, lastTotal + i, sizeof(lt));
+        memcpy(&li, lastIdle + i, sizeof(li));
+
+        u64x4 elapsed = t - lt;
+        u64x4 busy = elapsed - (id - li);
+        // Busy is 0 whenever elapsed is, dividing by 1 instead keeps the result at 0
+        elapsed += (u64x4)(elapsed == 0) & 1;
+
+        f64x4 pct = __builtin_convertvector(busy, f64x4) * 100.0 / __builtin_convertvector(elapsed, f64x4);
+        f32x4 out = __builtin_convertvector(pct, f32x4);
+        memcpy(percent + i, &out, sizeof(out));
+    }
+
+    for (; i < count; i++)
+    {
+        uint64_t elapsed = total[i] - lastTotal[i];
+        uint64_t busy = elapsed - (idle[i] - lastIdle[i]);
+        percent[i] = elapsed ? (float)((double)busy * 100.0 / elapsed) : 0;
+    }
+}
+
+/**
+ * @brief Per-core utilisation from the cpuN lines of /proc/stat.
+ * Jiffies are kept as arrays indexed by core number, sized for every possible CPU up front,
+ * so cores going offline and coming back only flip their online flag.
+ */
+struct CoreSampler
+{
+    size_t capacity = 0;
+
+    vector<char> buf; // grown until it holds every cpu line, then reused
+    vector<uint64_t> total, idle, lastTotal, lastIdle;
+    vector<uint8_t> online, wasOnline;
+    vector<float> percent;
+
+    // Figures of the latest sample, over the cores that were online for both snapshots
+    int cores = 0;
+    int hottest = -1;
+    float hottestPercent = 0;
+    float averagePercent = 0;
+    float imbalance = 0; // hottest minus average, in percentage points
+
+    CoreSampler()
+    {
+        reserve(max(sysconf(_SC_NPROCESSORS_CONF), 1L));
+        buf.resize(256 + 128 * capacity);
+    }
+
+    void reserve(size_t cores)
+    {
+        capacity = cores;
+        // Rounded up so the kernel never needs its scalar tail
+        size_t padded = (cores + 3) & ~(size_t)3;
+        for (auto *v : {&total, &idle, &lastTotal, &lastIdle})
+        {
+            v->resize(padded, 0);
+        }
+        online.resize(padded, 0);
+        wasOnline.resize(padded, 0);
+        percent.resize(padded, 0);
+    }
+
+    /**
+     * @brief Start a new snapshot, every core is offline until set
+     */
+    void begin()
+    {
+        memset(online.data(), 0, online.size());
+    }
+
+    void set(size_t core, uint64_t coreTotal, uint64_t coreIdle)
+    {
+        if (core >= capacity)
+        {
+            // More CPUs than the system said were possible, only ever happens once
+            reserve(core + 1);
+        }
+
+        total[core] = coreTotal;
+        idle[core] = coreIdle;
+        online[core] = 1;
+    }
+
+    /**
+     * @brief Read /proc/stat into buf and take a snapshot of every cpuN line
+     * @return The buffer, for parsing the aggregate line from the same read, or nullptr on error
+     */
+    const char *read()
+    {
+        while (true)
+        {
+            ssize_t n = procStat.read(buf.data(), buf.size());
+            if (n <= 0)
+            {
+                return nullptr;
+            }
+
+            const char *end = parse(buf.data());
+            // The cpu lines must be followed by something, or they may have been cut off
+            if (end && *end)
+            {
+                return buf.data();
+            }
+            if ((size_t)n < buf.size() - 1)
+            {
+                return end ? buf.data() : nullptr;
+            }
+            buf.resize(buf.size() * 2);
+        }
+    }
+
+    /**
+     * @brief Parse the cpuN lines
+     * @return Pointer to the first line after them
+     */
+    const char *parse(const char *p)
+    {
+        begin();
+
+        while (strncmp(p, "cpu", 3) == 0)
+        {
+            const char *line = p + 3;
+            const char *next = strchr(line, '\n');
+            if (!next)
+            {
+                return nullptr;
+            }
+
+            if (*line != ' ')
+            {
+                size_t core = scanNumber(line);
+
+                // user nice system idle iowait irq softirq steal, guests are already in user and nice
+                uint64_t columns[8] = {};
+                for (auto &column : columns)
+                {
+                    column = scanNumber(line);
+                }
+
+                uint64_t sum = 0;
+                for (auto column : columns)
+                {
+                    sum += column;
+                }
+                set(core, sum, columns[3] + columns[4]);
+            }
+
+            p = next + 1;
+        }
+        return p;
+    }
+
+    /**
+     * @brief Compute the percentages of the snapshot against the previous one
+     */
+    void compute()
+    {
+        for (size_t i = 0; i < capacity; i++)
+        {
+            // Hotplugged cores and counters that went backwards have nothing to compare against
+            bool comparable = online[i] && wasOnline[i] && total[i] >= lastTotal[i] && idle[i] >= lastIdle[i] &&
+                              total[i] - lastTotal[i] >= idle[i] - lastIdle[i];
+            if (!comparable)
+            {
+                lastTotal[i] = total[i];
+                lastIdle[i] = idle[i];
+            }
+        }
+
+        corePercentages(total.data(), idle.data(), lastTotal.data(), lastIdle.data(), percent.data(), total.size());
+
+        cores = 0;
+        hottest = -1;
+        hottestPercent = 0;
+        double sum = 0;
+        for (size_t i = 0; i < capacity; i++)
+        {
+            if (!online[i] || !wasOnline[i])
+            {
+                continue;
+            }
+
+            cores++;
+            sum += percent[i];
+            if (hottest == -1 || percent[i] > hottestPercent)
+            {
+                hottest = i;
+                hottestPercent = percent[i];
+            }
+        }
+        averagePercent = cores ? sum / cores : 0;
+        imbalance = hottestPercent - averagePercent;
+
+        lastTotal.swap(total);
+        lastIdle.swap(idle);
+        wasOnline.swap(online);
+    }
+
+    bool valid() const
+    {
+        return hottest != -1;
+    }
+
+    string summary() const
+    {
+        char out[128];
+        snprintf(out, sizeof(out), "online=%d avg=%.1f%% hottest=cpu%d %.1f%% imbalance=%.1f",
+                 cores, averagePercent, hottest, hottestPercent, imbalance);
+        return out;
+    }
+};
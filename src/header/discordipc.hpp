@@ -0,0 +1,366 @@
+#pragma once
+
+#include <sys/epoll.h>
+
+/*
+ * Native client for Discord's local RPC protocol, as an alternative to the Game SDK.
+ * Frames on the discord-ipc-N socket are a little-endian opcode and length followed by JSON.
+ */
+
+#define DISCORD_CLIENT_ID "934099338374824007" // Change with your own app's ID if you made one
+
+// Discord cuts longer activity strings off or rejects them
+#define DISCORD_MAX_TEXT 128
+
+enum DiscordIpcOpcode : uint32_t
+{
+    IPC_HANDSHAKE = 0,
+    IPC_FRAME = 1,
+    IPC_CLOSE = 2,
+    IPC_PING = 3,
+    IPC_PONG = 4
+};
+
+struct DiscordIpcClient
+{
+    int fd = -1;
+    bool ready = false;
+    string path;
+
+    string in;   // received bytes that don't form a complete frame yet
+    string out;  // frames the socket didn't take yet
+    string json; // reused to serialise messages
+
+    ActivityPayload pendingActivity;
+    bool hasPendingActivity = false;
+    unsigned long nonce = 0;
+
+    // Result of every SET_ACTIVITY, with Discord's error message on failure
+    function<void(bool, const string &)> onResult;
+    // Asked to watch the socket for writability while frames are queued
+    function<void(bool)> onWantWrite;
+    // Discord answered the handshake
+    function<void()> onReady;
+    // The connection broke, called before the socket is closed
+    function<void(const string &)> onLost;
+
+    ~DiscordIpcClient()
+    {
+        disconnect();
+    }
+
+    /**
+     * @brief Connect to the first live discord-ipc socket and send the handshake.
+     * The connection is ready once Discord answers with READY.
+     */
+    bool connect()
+    {
+        disconnect();
+
+        path = findDiscordIpcSocket();
+        if (path.empty())
+        {
+            return false;
+        }
+
+        fd = connectUnixSocket(path, true);
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        json.clear();
+        json += "{\"v\":1,\"client_id\":";
+        jsonAppendString(json, DISCORD_CLIENT_ID);
+        json += "}";
+        // Not flushed here, the socket isn't watched yet. The first EPOLLOUT writes it, see wantsWrite().
+        queue(IPC_HANDSHAKE, json);
+
+        LOG("Connected to Discord IPC at " + path, LogType::DEBUG);
+        return connected();
+    }
+
+    void disconnect()
+    {
+        if (fd != -1)
+        {
+            close(fd);
+            fd = -1;
+        }
+        ready = false;
+        in.clear();
+        out.clear();
+    }
+
+    void lost(const string &message)
+    {
+        LOG(message, LogType::ERROR);
+        if (onLost)
+        {
+            onLost(message);
+        }
+        disconnect();
+    }
+
+    bool connected() const
+    {
+        return fd != -1;
+    }
+
+    /**
+     * @brief Whether frames are waiting for the socket to become writable
+     */
+    bool wantsWrite() const
+    {
+        return !out.empty();
+    }
+
+    void setActivity(const ActivityPayload &payload)
+    {
+        if (!ready)
+        {
+            // Sent as soon as Discord is ready
+            pendingActivity = payload;
+            hasPendingActivity = true;
+            return;
+        }
+
+        json.clear();
+        json += "{\"cmd\":\"SET_ACTIVITY\",\"args\":{\"pid\":";
+        json += to_string(getpid());
+        json += ",\"activity\":{";
+
+        bool first = true;
+        appendField(json, first, "details", payload.details);
+        appendField(json, first, "state", payload.state);
+
+        if (payload.start)
+        {
+            json += first ? "" : ",";
+            json += "\"timestamps\":{\"start\":" + to_string(payload.start) + "}";
+            first = false;
+        }
+
+        json += first ? "" : ",";
+        json += "\"assets\":{";
+        bool firstAsset = true;
+        appendField(json, firstAsset, "large_image", payload.largeImage);
+        appendField(json, firstAsset, "large_text", payload.largeText);
+        appendField(json, firstAsset, "small_image", payload.smallImage);
+        appendField(json, firstAsset, "small_text", payload.smallText);
+        json += "}";
+
+        if (payload.type != ActivityType::Playing)
+        {
+            json += ",\"type\":" + to_string(static_cast<int>(payload.type));
+        }
+
+        json += "}},\"nonce\":\"" + to_string(++nonce) + "\"}";
+        send(IPC_FRAME, json);
+    }
+
+    /**
+     * @brief Add "key":"value" to an object, skipping empty values which Discord rejects
+     */
+    static void appendField(string &out, bool &first, const char *key, const string &value)
+    {
+        if (value.empty())
+        {
+            return;
+        }
+
+        if (!first)
+        {
+            out += ',';
+        }
+        first = false;
+
+        out += '"';
+        out += key;
+        out += "\":";
+
+        if (value.size() <= DISCORD_MAX_TEXT)
+        {
+            jsonAppendString(out, value);
+            return;
+        }
+
+        // Cut at a character boundary, not in the middle of a UTF-8 sequence
+        size_t length = DISCORD_MAX_TEXT;
+        while (length > 0 && ((unsigned char)value[length] & 0xc0) == 0x80)
+        {
+            length--;
+        }
+        jsonAppendString(out, value.substr(0, length));
+    }
+
+    void send(DiscordIpcOpcode opcode, const string &body)
+    {
+        bool wasEmpty = out.empty();
+        queue(opcode, body);
+
+        if (wasEmpty)
+        {
+            flush();
+        }
+    }
+
+    /**
+     * @brief Append a frame to the output without writing anything yet
+     */
+    void queue(DiscordIpcOpcode opcode, const string &body)
+    {
+        uint32_t header[2] = {opcode, (uint32_t)body.size()};
+        for (uint32_t value : header)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                out += (char)((value >> (8 * i)) & 0xff);
+            }
+        }
+        out += body;
+    }
+
+    /**
+     * @brief Write as much of the queued frames as the socket takes
+     */
+    void flush()
+    {
+        while (!out.empty() && fd != -1)
+        {
+            ssize_t n = ::send(fd, out.data(), out.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n > 0)
+            {
+                out.erase(0, n);
+                continue;
+            }
+
+            if (n == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                break;
+            }
+
+            lost(string("Failed to write to Discord IPC: ") + strerror(errno));
+            return;
+        }
+
+        if (onWantWrite)
+        {
+            onWantWrite(!out.empty());
+        }
+    }
+
+    /**
+     * @brief Handle socket events
+     * @return false if the connection was lost
+     */
+    bool dispatch(uint32_t events)
+    {
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        if (events & EPOLLOUT)
+        {
+            flush();
+        }
+
+        char chunk[4096];
+        bool closed = false;
+        while (fd != -1)
+        {
+            ssize_t n = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+            if (n > 0)
+            {
+                in.append(chunk, n);
+                continue;
+            }
+
+            if (n == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            // Frames sent right before hanging up (results, CLOSE) are still handled below
+            closed = n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+            break;
+        }
+
+        size_t pos = 0;
+        while (fd != -1 && in.size() - pos >= 8)
+        {
+            const unsigned char *header = (const unsigned char *)in.data() + pos;
+            uint32_t opcode = header[0] | header[1] << 8 | header[2] << 16 | (uint32_t)header[3] << 24;
+            uint32_t length = header[4] | header[5] << 8 | header[6] << 16 | (uint32_t)header[7] << 24;
+
+            if (in.size() - pos - 8 < length)
+            {
+                break;
+            }
+
+            handleFrame(opcode, in.substr(pos + 8, length));
+            pos += 8 + length;
+        }
+
+        if (closed && fd != -1)
+        {
+            lost("Discord closed the IPC connection");
+        }
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        in.erase(0, pos);
+        return true;
+    }
+
+    void handleFrame(uint32_t opcode, const string &body)
+    {
+        string cmd, evt, message;
+
+        switch (opcode)
+        {
+        case IPC_FRAME:
+            jsonGetString(body, "cmd", cmd);
+            jsonGetString(body, "evt", evt);
+
+            if (cmd == "DISPATCH" && evt == "READY")
+            {
+                LOG("Discord IPC is ready", LogType::DEBUG);
+                ready = true;
+                if (hasPendingActivity)
+                {
+                    hasPendingActivity = false;
+                    setActivity(pendingActivity);
+                }
+                if (onReady)
+                {
+                    onReady();
+                }
+            }
+            else if (cmd == "SET_ACTIVITY" && onResult)
+            {
+                jsonGetString(body, "message", message);
+                onResult(evt != "ERROR", message);
+            }
+            break;
+
+        case IPC_PING:
+            send(IPC_PONG, body);
+            break;
+
+        case IPC_CLOSE:
+            jsonGetString(body, "message", message);
+            lost("Discord closed the IPC connection: " + message);
+            break;
+
+        default:
+            break;
+        }
+    }
+};
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <sys/inotify.h>
+#include <poll.h>
+
+#define DISCORD_IPC_PREFIX "discord-ipc-"
+
+/**
+ * @brief Directories Discord creates its discord-ipc-N sockets in,
+ * including the ones used by the flatpak and snap packages
+ */
+vector<string> discordIpcDirectories()
+{
+    vector<string> dirs;
+
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    for (const char *var : {"XDG_RUNTIME_DIR", "TMPDIR", "TMP", "TEMP"})
+    {
+        const char *value = getenv(var);
+        if (value && *value)
+        {
+            dirs.push_back(value);
+            break;
+        }
+    }
+    if (dirs.empty())
+    {
+        dirs.push_back("/tmp");
+    }
+
+    if (runtime && *runtime)
+    {
+        string base(runtime);
+        dirs.push_back(base + "/app/com.discordapp.Discord");
+        dirs.push_back(base + "/app/com.discordapp.DiscordCanary");
+        dirs.push_back(base + "/app/dev.vencord.Vesktop");
+        dirs.push_back(base + "/snap.discord");
+        dirs.push_back(base + "/snap.discord-canary");
+    }
+
+    return dirs;
+}
+
+/**
+ * @brief Check if a Discord client is listening on one of its IPC sockets.
+ * Stale sockets left behind by a crashed client refuse the connection.
+ * @return Path of the first live socket, or an empty string
+ */
+string findDiscordIpcSocket()
+{
+    for (const auto &dir : discordIpcDirectories())
+    {
+        for (int i = 0; i < 10; i++)
+        {
+            string path = dir + "/" + DISCORD_IPC_PREFIX + to_string(i);
+            if (access(path.c_str(), F_OK) != 0)
+            {
+                continue;
+            }
+
+            int sock = connectUnixSocket(path, false);
+            if (sock != -1)
+            {
+                close(sock);
+                return path;
+            }
+        }
+    }
+    return "";
+}
+
+/**
+ * @brief Waits for Discord's IPC sockets to appear using inotify, so waiting costs nothing
+ * and we notice Discord within milliseconds of it starting.
+ */
+struct DiscordReadinessWatcher
+{
+    int fd = -1;
+    vector<int> watches;
+
+    ~DiscordReadinessWatcher()
+    {
+        if (fd != -1)
+        {
+            close(fd);
+        }
+    }
+
+    bool init()
+    {
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd == -1)
+        {
+            LOG(string("inotify is unavailable: ") + strerror(errno), LogType::WARN);
+            return false;
+        }
+
+        addWatches();
+        return !watches.empty();
+    }
+
+    /**
+     * @brief Watch every IPC directory, or its closest existing parent if it doesn't exist yet
+     * (the flatpak directories are created when the app starts)
+     */
+    void addWatches()
+    {
+        for (int wd : watches)
+        {
+            inotify_rm_watch(fd, wd);
+        }
+        watches.clear();
+
+        for (string dir : discordIpcDirectories())
+        {
+            while (!dir.empty())
+            {
+                int wd = inotify_add_watch(fd, dir.c_str(), IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+                if (wd != -1)
+                {
+                    watches.push_back(wd);
+                    break;
+                }
+
+                if (errno != ENOENT)
+                {
+                    break;
+                }
+                dir = dir.substr(0, dir.rfind('/'));
+            }
+        }
+    }
+
+    /**
+     * @brief Block until Discord is ready or the timeout expires
+     * @return true if a live IPC socket was found
+     */
+    bool wait(int timeoutMs)
+    {
+        auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeoutMs);
+
+        while (true)
+        {
+            int remaining = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+            if (remaining <= 0)
+            {
+                return false;
+            }
+
+            struct pollfd pfd = {fd, POLLIN, 0};
+            int n = poll(&pfd, 1, remaining);
+            if (n == 0)
+            {
+                return false;
+            }
+            if (n == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+
+            if (drain())
+            {
+                // The socket is created before Discord listens on it, give it a moment
+                for (int attempt = 0; attempt < 50; attempt++)
+                {
+                    string path = findDiscordIpcSocket();
+                    if (!path.empty())
+                    {
+                        LOG("Discord IPC socket appeared: " + path, LogType::DEBUG);
+                        return true;
+                    }
+                    usleep(20000);
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Read pending inotify events
+     * @return true if one of them looks like a Discord IPC socket
+     */
+    bool drain()
+    {
+        alignas(struct inotify_event) char buf[4096];
+        bool candidate = false;
+        bool newDirectory = false;
+        ssize_t n;
+
+        while ((n = read(fd, buf, sizeof(buf))) > 0)
+        {
+            for (char *p = buf; p < buf + n;)
+            {
+                auto *event = (struct inotify_event *)p;
+                p += sizeof(struct inotify_event) + event->len;
+
+                if (event->len == 0)
+                {
+                    continue;
+                }
+
+                if (event->mask & IN_ISDIR)
+                {
+                    newDirectory = true;
+                }
+                else if (strncmp(event->name, DISCORD_IPC_PREFIX, strlen(DISCORD_IPC_PREFIX)) == 0)
+                {
+                    candidate = true;
+                }
+            }
+        }
+
+        if (newDirectory)
+        {
+            // A parent we were watching gained a child, maybe one of the IPC directories
+            addWatches();
+            candidate = candidate || !findDiscordIpcSocket().empty();
+        }
+
+        return candidate;
+    }
+};
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <unordered_map>
+
+struct CachedWindow
+{
+    string windowClass;
+    int pid = 0;
+};
+
+/**
+ * @brief Tracks the focused X window through PropertyNotify events on the root window.
+ * Nothing is sent to the X server until _NET_ACTIVE_WINDOW actually changes,
+ * and class hints are only fetched for windows that weren't seen before.
+ * With watchTitle set, the focused window itself is watched too, so its title
+ * is only read again when the window reports that it changed.
+ */
+struct X11FocusWatcher
+{
+    xcb_connection_t *conn = nullptr;
+    const XcbAtoms *atoms = nullptr;
+    xcb_window_t root = XCB_WINDOW_NONE;
+    xcb_window_t activeWindow = XCB_WINDOW_NONE;
+    string activeClass;
+    string activeTitle;
+    int activePid = 0;
+    unordered_map<xcb_window_t, CachedWindow> windowCache;
+
+    bool watchTitle = false;
+    bool watchPid = false; // also resolve _NET_WM_PID of focused windows
+
+    // Window IDs get recycled, so don't let the cache grow forever
+    static constexpr size_t maxCachedWindows = 128;
+
+    /**
+     * @brief Subscribe to root window property changes and read the initial focus
+     */
+    void init(xcb_connection_t *c, const XcbAtoms &a)
+    {
+        conn = c;
+        atoms = &a;
+        root = screenRoot(conn);
+
+        uint32_t mask = XCB_EVENT_MASK_PROPERTY_CHANGE;
+        xcb_change_window_attributes(conn, root, XCB_CW_EVENT_MASK, &mask);
+        refresh();
+    }
+
+    /**
+     * @brief Drain queued X events without blocking
+     * @param queuedOnly only take what XCB already read, without reading the socket
+     * @return true if the focused window changed, or its title if watchTitle is set
+     */
+    bool dispatch(bool queuedOnly = false)
+    {
+        bool changed = false;
+        bool titleChanged = false;
+        xcb_generic_event_t *ev;
+
+        while ((ev = queuedOnly ? xcb_poll_for_queued_event(conn) : xcb_poll_for_event(conn)))
+        {
+            if ((ev->response_type & ~0x80) == XCB_PROPERTY_NOTIFY)
+            {
+                auto *notify = (xcb_property_notify_event_t *)ev;
+                if (notify->window == root)
+                {
+                    changed = changed || notify->atom == atoms->netActiveWindow;
+                }
+                else if (notify->window == activeWindow)
+                {
+                    titleChanged = titleChanged || notify->atom == atoms->netWmName || notify->atom == XCB_ATOM_WM_NAME;
+                }
+            }
+            free(ev);
+        }
+
+        if (changed)
+        {
+            xcb_window_t previous = activeWindow;
+            refresh();
+            if (activeWindow != previous)
+            {
+                return true;
+            }
+        }
+
+        if (!titleChanged || !watchTitle || activeWindow == XCB_WINDOW_NONE)
+        {
+            return false;
+        }
+
+        auto cookies = requestTitle(activeWindow);
+        stats.xRoundTrips.fetch_add(1, memory_order_relaxed);
+        string title = titleReply(cookies);
+        if (title == activeTitle)
+        {
+            return false;
+        }
+
+        activeTitle = title;
+        return true;
+    }
+
+    void refresh()
+    {
+        stats.xRoundTrips.fetch_add(1, memory_order_relaxed);
+        xcb_window_t w = windowReply(conn, requestProperty(conn, root, atoms->netActiveWindow, XCB_ATOM_WINDOW));
+        if (w == activeWindow)
+        {
+            return;
+        }
+
+        if (watchTitle)
+        {
+            moveTitleSubscription(activeWindow, w);
+        }
+
+        activeWindow = w;
+        if (w == XCB_WINDOW_NONE)
+        {
+            activeClass = "";
+            activeTitle = "";
+            activePid = 0;
+            return;
+        }
+
+        // Everything about the new window is asked for before waiting, so it takes one round trip
+        auto cached = windowCache.find(w);
+        bool haveWindow = cached != windowCache.end();
+        xcb_get_property_cookie_t classCookie, pidCookie;
+        pair<xcb_get_property_cookie_t, xcb_get_property_cookie_t> titleCookies;
+
+        if (!haveWindow)
+        {
+            classCookie = requestProperty(conn, w, XCB_ATOM_WM_CLASS, XCB_ATOM_STRING);
+            if (watchPid)
+            {
+                pidCookie = requestProperty(conn, w, atoms->netWmPid, XCB_ATOM_CARDINAL);
+            }
+        }
+        if (watchTitle)
+        {
+            titleCookies = requestTitle(w);
+        }
+        if (!haveWindow || watchTitle)
+        {
+            stats.xRoundTrips.fetch_add(1, memory_order_relaxed);
+        }
+
+        const CachedWindow &info = haveWindow ? cached->second : collectWindow(w, classCookie, pidCookie);
+        activeClass = info.windowClass;
+        activePid = info.pid;
+        activeTitle = watchTitle ? titleReply(titleCookies) : "";
+        LOG("Focus moved to window " + to_string(w) + " (" + activeClass + ")", LogType::DEBUG);
+    }
+
+    /**
+     * @brief Only get PropertyNotify from the focused window, not from every window that had focus
+     */
+    void moveTitleSubscription(xcb_window_t from, xcb_window_t to)
+    {
+        uint32_t none = XCB_EVENT_MASK_NO_EVENT;
+        uint32_t mask = XCB_EVENT_MASK_PROPERTY_CHANGE;
+
+        // The old window may be gone already, the error ends up in the event queue and is ignored
+        if (from != XCB_WINDOW_NONE && from != root)
+        {
+            xcb_change_window_attributes(conn, from, XCB_CW_EVENT_MASK, &none);
+        }
+        if (to != XCB_WINDOW_NONE && to != root)
+        {
+            xcb_change_window_attributes(conn, to, XCB_CW_EVENT_MASK, &mask);
+        }
+    }
+
+    /**
+     * @brief Collect the class and pid of a window that isn't cached yet
+     */
+    const CachedWindow &collectWindow(xcb_window_t w, xcb_get_property_cookie_t classCookie, xcb_get_property_cookie_t pidCookie)
+    {
+        CachedWindow info;
+
+        // WM_CLASS is the instance name and the class name, both NUL terminated
+        string value;
+        if (propertyReply(conn, classCookie, {XCB_ATOM_STRING}, value))
+        {
+            size_t instanceEnd = value.find('\0');
+            info.windowClass = instanceEnd == string::npos ? "" : string(value.c_str() + instanceEnd + 1);
+        }
+
+        if (watchPid)
+        {
+            info.pid = windowReply(conn, pidCookie, XCB_ATOM_CARDINAL);
+        }
+
+        if (windowCache.size() >= maxCachedWindows)
+        {
+            windowCache.clear();
+        }
+        return windowCache[w] = info;
+    }
+
+    /**
+     * @brief Ask for _NET_WM_NAME and the legacy WM_NAME at once
+     */
+    pair<xcb_get_property_cookie_t, xcb_get_property_cookie_t> requestTitle(xcb_window_t w)
+    {
+        return {requestProperty(conn, w, atoms->netWmName, atoms->utf8String),
+                requestProperty(conn, w, XCB_ATOM_WM_NAME)};
+    }
+
+    string titleReply(pair<xcb_get_property_cookie_t, xcb_get_property_cookie_t> cookies)
+    {
+        string netName, name;
+        bool haveNetName = propertyReply(conn, cookies.first, {atoms->utf8String}, netName);
+        bool haveName = propertyReply(conn, cookies.second, {atoms->utf8String, XCB_ATOM_STRING}, name);
+
+        if (haveNetName)
+        {
+            return netName.c_str();
+        }
+        return haveName ? name.c_str() : "";
+    }
+};
@@ -0,0 +1,255 @@
+#pragma once
+
+/**
+ * @brief Build the path of one of Hyprland's IPC sockets
+ * @param name ".socket.sock" for requests, ".socket2.sock" for the event stream
+ * @return Empty string if Hyprland's environment variables are not set
+ */
+string hyprlandSocketPath(const char *name)
+{
+    const char *xdgRuntimeDir = getenv("XDG_RUNTIME_DIR");
+    const char *hyprlandSignature = getenv("HYPRLAND_INSTANCE_SIGNATURE");
+
+    if (!xdgRuntimeDir || !hyprlandSignature)
+    {
+        return "";
+    }
+
+    return string(xdgRuntimeDir) + "/hypr/" + string(hyprlandSignature) + "/" + name;
+}
+
+/**
+ * @brief Long-lived subscription to Hyprland's socket2 event stream.
+ * Events are pushed by Hyprland, so reading them costs nothing while focus doesn't change.
+ * Lines may arrive split across reads, they are reassembled from a ring buffer.
+ */
+struct HyprlandEvents : CompositorBackend
+{
+    string activeAddress;
+    string workspace;
+    string monitor;
+
+    // Power of two, so positions can be masked instead of wrapped
+    static constexpr size_t bufferSize = 8192;
+    char buffer[bufferSize];
+    size_t head = 0; // next byte to parse
+    size_t tail = 0; // next byte to write
+    size_t scan = 0; // next byte to check for a newline
+    bool discarding = false; // current line didn't fit into the buffer
+    string line;
+
+    const char *name() const override
+    {
+        return "Hyprland";
+    }
+
+    bool subscribe() override
+    {
+        fd = connectUnixSocket(hyprlandSocketPath(".socket2.sock"), true);
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        head = tail = scan = 0;
+        discarding = false;
+        queryActiveWindow();
+        return true;
+    }
+
+    /**
+     * @brief socket2 only reports changes, so ask the request socket once for the
+     * window that is focused at the time we (re)connect.
+     */
+    void queryActiveWindow()
+    {
+        int sock = connectUnixSocket(hyprlandSocketPath(".socket.sock"), false);
+        if (sock == -1)
+        {
+            return;
+        }
+
+        // Don't let a stuck compositor hang us here
+        struct timeval timeout = {1, 0};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        string response;
+        char chunk[4096];
+        ssize_t n;
+
+        if (send(sock, "activewindow", 12, 0) != -1)
+        {
+            while ((n = recv(sock, chunk, sizeof(chunk), 0)) > 0)
+            {
+                response.append(chunk, n);
+            }
+        }
+        close(sock);
+
+        activeClass = responseField(response, "class: ");
+        activeTitle = responseField(response, "title: ");
+        activePid = atoi(responseField(response, "pid: ").c_str());
+
+        // "Window <address> -> <title>:", the address in the form closewindow events use
+        size_t arrow = response.compare(0, 7, "Window ") == 0 ? response.find(" -> ", 7) : string::npos;
+        activeAddress = arrow == string::npos ? "" : response.substr(7, arrow - 7);
+    }
+
+    static string responseField(const string &response, const string &key)
+    {
+        size_t pos = response.find("\t" + key);
+        if (pos == string::npos)
+        {
+            return "";
+        }
+        pos += key.size() + 1;
+        return response.substr(pos, response.find('\n', pos) - pos);
+    }
+
+    /**
+     * @brief Read whatever Hyprland has sent without blocking and apply complete lines.
+     * Events don't carry the pid, with watchPid it's asked for whenever the focused window changes.
+     */
+    bool dispatch() override
+    {
+        if (fd == -1 && !reconnect())
+        {
+            return false;
+        }
+
+        string previousClass = activeClass;
+        string previousTitle = activeTitle;
+        string previousAddress = activeAddress;
+
+        while (true)
+        {
+            size_t used = tail - head;
+            if (used == bufferSize)
+            {
+                // A single line filled the whole buffer, skip to its end
+                LOG("Dropping oversized Hyprland event line", LogType::WARN);
+                head = scan = tail;
+                discarding = true;
+                continue;
+            }
+
+            // Read into the contiguous free region after tail
+            size_t start = tail & (bufferSize - 1);
+            size_t room = min(bufferSize - used, bufferSize - start);
+            ssize_t n = recv(fd, buffer + start, room, MSG_DONTWAIT);
+
+            if (n > 0)
+            {
+                tail += n;
+                parseLines();
+                continue;
+            }
+
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                break;
+            }
+            if (n == -1 && errno == EINTR)
+            {
+                continue;
+            }
+
+            LOG("Lost connection to Hyprland IPC socket", LogType::ERROR);
+            disconnect();
+            reconnect();
+            break;
+        }
+
+        if (watchPid && activeAddress != previousAddress)
+        {
+            queryActiveWindow();
+        }
+
+        return activeClass != previousClass || (watchTitle && activeTitle != previousTitle);
+    }
+
+    void parseLines()
+    {
+        for (; scan != tail; scan++)
+        {
+            if (buffer[scan & (bufferSize - 1)] != '\n')
+            {
+                continue;
+            }
+
+            if (discarding)
+            {
+                discarding = false;
+            }
+            else
+            {
+                line.clear();
+                for (size_t i = head; i != scan; i++)
+                {
+                    line += buffer[i & (bufferSize - 1)];
+                }
+                handleLine(line);
+            }
+            head = scan + 1;
+        }
+    }
+
+    void handleLine(const string &l)
+    {
+        size_t sep = l.find(">>");
+        if (sep == string::npos)
+        {
+            return;
+        }
+
+        string event = l.substr(0, sep);
+        string data = l.substr(sep + 2);
+
+        if (event == "activewindow")
+        {
+            // CLASS,TITLE - titles may contain commas, classes don't
+            size_t comma = data.find(',');
+            activeClass = data.substr(0, comma);
+            activeTitle = comma == string::npos ? "" : data.substr(comma + 1);
+        }
+        else if (event == "activewindowv2")
+        {
+            activeAddress = data;
+        }
+        else if (event == "windowtitlev2")
+        {
+            // ADDRESS,TITLE
+            size_t comma = data.find(',');
+            if (comma != string::npos && !activeAddress.empty() && data.compare(0, comma, activeAddress) == 0)
+            {
+                activeTitle = data.substr(comma + 1);
+            }
+        }
+        else if (event == "workspace")
+        {
+            workspace = data;
+        }
+        else if (event == "workspacev2")
+        {
+            // ID,NAME
+            workspace = data.substr(data.find(',') + 1);
+        }
+        else if (event == "focusedmon")
+        {
+            // MONNAME,WORKSPACENAME
+            size_t comma = data.find(',');
+            monitor = data.substr(0, comma);
+            if (comma != string::npos)
+            {
+                workspace = data.substr(comma + 1);
+            }
+        }
+        else if (event == "closewindow" && data == activeAddress)
+        {
+            activeClass = "";
+            activeTitle = "";
+            activeAddress = "";
+            activePid = 0;
+        }
+    }
+};
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <X11/extensions/sync.h>
+#include <X11/extensions/scrnsaver.h>
+
+// How often the XScreenSaver fallback checks for input while the user is away
+#define IDLE_POLL_MS 1000
+
+/**
+ * @brief Tells when the user stops and starts using the session.
+ * Like CompositorBackend, a backend either gets events on fd or, with polling set, is
+ * asked through poll() by a timer. Wayland sessions would plug in ext-idle-notify or a
+ * compositor's own IPC here.
+ */
+struct IdleBackend
+{
+    int fd = -1; // where events arrive, -1 for backends that are only polled
+    bool enabled = false;
+    bool polling = false;
+    bool idle = false;
+    long timeoutMs = 0;
+
+    function<void(bool)> onChange;
+
+    virtual ~IdleBackend() {}
+
+    virtual const char *name() const = 0;
+
+    /**
+     * @brief Handle whatever arrived on fd without blocking
+     */
+    virtual void dispatch() {}
+
+    /**
+     * @brief Handle events a client library already read off fd into its own queue.
+     * Runs before every wait, since fd doesn't become readable for those.
+     */
+    virtual void dispatchQueued() {}
+
+    /**
+     * @brief Check the idle time, only called when polling is set
+     * @return Milliseconds until the next check is needed
+     */
+    virtual long poll()
+    {
+        return timeoutMs;
+    }
+
+    void setIdle(bool value)
+    {
+        if (value == idle)
+        {
+            return;
+        }
+
+        idle = value;
+        LOG(idle ? "User went idle" : "User is back", LogType::DEBUG);
+        if (onChange)
+        {
+            onChange(idle);
+        }
+    }
+};
+
+/**
+ * @brief Idle detection for the X session.
+ * Preferably driven by alarms on the SYNC extension's IDLETIME counter, so entering and
+ * leaving idle are both events and nothing is polled. Servers without that counter fall
+ * back to the XScreenSaver extension's idle time, which has to be polled.
+ */
+struct X11IdleWatcher : IdleBackend
+{
+    Display *disp = nullptr;
+
+    // SYNC backend
+    int syncEventBase = 0;
+    XSyncCounter idleCounter = None;
+    XSyncAlarm alarm = None;
+
+    // XScreenSaver backend, poll() is called by a timer
+    XScreenSaverInfo *saverInfo = nullptr;
+
+    ~X11IdleWatcher()
+    {
+        if (saverInfo)
+        {
+            XFree(saverInfo);
+        }
+    }
+
+    const char *name() const override
+    {
+        return polling ? "xscreensaver" : "x11-sync";
+    }
+
+    bool init(Display *d, long timeout)
+    {
+        disp = d;
+        timeoutMs = timeout;
+
+        int errorBase, major, minor;
+        if (XSyncQueryExtension(disp, &syncEventBase, &errorBase) && XSyncInitialize(disp, &major, &minor))
+        {
+            int count = 0;
+            XSyncSystemCounter *counters = XSyncListSystemCounters(disp, &count);
+            for (int i = 0; i < count; i++)
+            {
+                if (!strcmp(counters[i].name, "IDLETIME"))
+                {
+                    idleCounter = counters[i].counter;
+                    break;
+                }
+            }
+            if (counters)
+            {
+                XSyncFreeSystemCounterList(counters);
+            }
+        }
+
+        if (idleCounter != None)
+        {
+            armAlarm(false);
+            fd = ConnectionNumber(disp);
+            enabled = true;
+            LOG("Idle detection through the SYNC IDLETIME counter", LogType::DEBUG);
+            return true;
+        }
+
+        int eventBase;
+        if (XScreenSaverQueryExtension(disp, &eventBase, &errorBase))
+        {
+            saverInfo = XScreenSaverAllocInfo();
+            polling = true;
+            enabled = true;
+            LOG("Idle detection through XScreenSaver", LogType::DEBUG);
+            return true;
+        }
+
+        LOG("No X extension to detect idleness, idle throttling disabled", LogType::DEBUG);
+        return false;
+    }
+
+    /**
+     * @brief Fire once the idle time reaches the timeout, or once it drops below it again
+     */
+    void armAlarm(bool waitForInput)
+    {
+        XSyncAlarmAttributes attr;
+        attr.trigger.counter = idleCounter;
+        attr.trigger.value_type = XSyncAbsolute;
+        attr.trigger.test_type = waitForInput ? XSyncNegativeComparison : XSyncPositiveComparison;
+        XSyncIntToValue(&attr.trigger.wait_value, waitForInput ? timeoutMs - 1 : timeoutMs);
+        XSyncIntToValue(&attr.delta, 0);
+        attr.events = True;
+
+        unsigned long flags = XSyncCACounter | XSyncCAValueType | XSyncCATestType | XSyncCAValue | XSyncCADelta | XSyncCAEvents;
+
+        // Comparison alarms with a zero delta go inactive after firing, changing them re-arms
+        if (alarm == None)
+        {
+            alarm = XSyncCreateAlarm(disp, flags, &attr);
+        }
+        else
+        {
+            XSyncChangeAlarm(disp, alarm, flags, &attr);
+        }
+        XFlush(disp);
+    }
+
+    void dispatch() override
+    {
+        XEvent ev;
+        while (XPending(disp))
+        {
+            XNextEvent(disp, &ev);
+            handleEvent(ev);
+        }
+    }
+
+    void dispatchQueued() override
+    {
+        XEvent ev;
+        while (XEventsQueued(disp, QueuedAlready))
+        {
+            XNextEvent(disp, &ev);
+            handleEvent(ev);
+        }
+    }
+
+    /**
+     * @brief Handle an X event
+     * @return true if it was one of our alarms
+     */
+    bool handleEvent(const XEvent &ev)
+    {
+        if (idleCounter == None || ev.type != syncEventBase + XSyncAlarmNotify)
+        {
+            return false;
+        }
+
+        const XSyncAlarmNotifyEvent *notify = (const XSyncAlarmNotifyEvent *)&ev;
+        if (notify->alarm != alarm || notify->state == XSyncAlarmDestroyed)
+        {
+            return false;
+        }
+
+        // The alarm was armed for the opposite of the current state
+        setIdle(!idle);
+        armAlarm(idle);
+        return true;
+    }
+
+    /**
+     * @brief Check the XScreenSaver idle time
+     */
+    long poll() override
+    {
+        stats.xRoundTrips.fetch_add(1, memory_order_relaxed);
+        if (!saverInfo || !XScreenSaverQueryInfo(disp, XDefaultRootWindow(disp), saverInfo))
+        {
+            return timeoutMs;
+        }
+
+        long idleMs = saverInfo->idle;
+        setIdle(idleMs >= timeoutMs);
+        return idle ? IDLE_POLL_MS : timeoutMs - idleMs;
+    }
+};
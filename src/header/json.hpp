@@ -0,0 +1,223 @@
+#pragma once
+
+/*
+ * Just enough JSON for the IPC protocols we speak: writing into a reusable buffer,
+ * and picking single values out of small, trusted messages.
+ */
+
+/**
+ * @brief Append value to out as a quoted JSON string
+ */
+void jsonAppendString(string &out, const string &value)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    out += '"';
+    for (unsigned char c : value)
+    {
+        switch (c)
+        {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if (c < 0x20)
+            {
+                out += "\\u00";
+                out += hex[c >> 4];
+                out += hex[c & 0xf];
+            }
+            else
+            {
+                out += c;
+            }
+        }
+    }
+    out += '"';
+}
+
+/**
+ * @brief Find the value of the first "key" in a JSON document, at any depth
+ * @return Position of the first character of the value, or string::npos
+ */
+size_t jsonFindKey(const string &json, const string &key, size_t from = 0)
+{
+    string quoted = "\"" + key + "\"";
+    size_t pos = from;
+
+    while ((pos = json.find(quoted, pos)) != string::npos)
+    {
+        pos += quoted.size();
+        size_t colon = json.find_first_not_of(" \t\r\n", pos);
+        if (colon != string::npos && json[colon] == ':')
+        {
+            return json.find_first_not_of(" \t\r\n", colon + 1);
+        }
+    }
+    return string::npos;
+}
+
+/**
+ * @brief Read the string value of the first "key"
+ * @return false if the key doesn't exist or isn't a string
+ */
+bool jsonGetString(const string &json, const string &key, string &value, size_t from = 0)
+{
+    size_t pos = jsonFindKey(json, key, from);
+    if (pos == string::npos || json[pos] != '"')
+    {
+        return false;
+    }
+
+    value.clear();
+    for (pos++; pos < json.size() && json[pos] != '"'; pos++)
+    {
+        if (json[pos] != '\\' || pos + 1 == json.size())
+        {
+            value += json[pos];
+            continue;
+        }
+
+        char escaped = json[++pos];
+        switch (escaped)
+        {
+        case 'n':
+            value += '\n';
+            break;
+        case 't':
+            value += '\t';
+            break;
+        case 'r':
+            value += '\r';
+            break;
+        case 'u':
+            // Only used for control characters and non-ASCII text here, which we don't need verbatim
+            value += '?';
+            pos += 4;
+            break;
+        default:
+            value += escaped;
+        }
+    }
+    return pos < json.size();
+}
+
+/**
+ * @brief Read the integer value of the first "key"
+ */
+bool jsonGetInt(const string &json, const string &key, long long &value, size_t from = 0)
+{
+    size_t pos = jsonFindKey(json, key, from);
+    if (pos == string::npos || (json[pos] != '-' && !isdigit((unsigned char)json[pos])))
+    {
+        return false;
+    }
+
+    value = strtoll(json.c_str() + pos, nullptr, 10);
+    return true;
+}
+
+/**
+ * @brief Skip over the value starting at pos, objects and arrays included
+ * @return Position right after it, or string::npos if the document ends first
+ */
+size_t jsonSkipValue(const string &json, size_t pos)
+{
+    int depth = 0;
+    bool inString = false;
+
+    for (; pos < json.size(); pos++)
+    {
+        char c = json[pos];
+        if (inString)
+        {
+            if (c == '\\')
+            {
+                pos++;
+            }
+            else if (c == '"')
+            {
+                inString = false;
+                if (depth == 0)
+                {
+                    return pos + 1;
+                }
+            }
+            continue;
+        }
+
+        switch (c)
+        {
+        case '"':
+            inString = true;
+            break;
+        case '{':
+        case '[':
+            depth++;
+            break;
+        case '}':
+        case ']':
+            if (--depth <= 0)
+            {
+                return depth == 0 ? pos + 1 : pos;
+            }
+            break;
+        case ',':
+            if (depth == 0)
+            {
+                return pos;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return depth == 0 && !inString ? pos : string::npos;
+}
+
+/**
+ * @brief Call handler with every element of the array that is the value of the first "key"
+ * @return false if there is no such array
+ */
+bool jsonForEach(const string &json, const string &key, const function<void(const string &)> &handler)
+{
+    size_t pos = jsonFindKey(json, key);
+    if (pos == string::npos || json[pos] != '[')
+    {
+        return false;
+    }
+
+    pos++;
+    while ((pos = json.find_first_not_of(" \t\r\n,", pos)) != string::npos && json[pos] != ']')
+    {
+        size_t end = jsonSkipValue(json, pos);
+        if (end == string::npos)
+        {
+            return false;
+        }
+        handler(json.substr(pos, end - pos));
+        pos = end;
+    }
+    return true;
+}
+
+/**
+ * @brief Whether the value of the first "key" is true
+ */
+bool jsonGetBool(const string &json, const string &key, size_t from = 0)
+{
+    size_t pos = jsonFindKey(json, key, from);
+    return pos != string::npos && json.compare(pos, 4, "true") == 0;
+}
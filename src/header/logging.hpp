@@ -1,5 +1,15 @@
 #pragma once
 
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <climits>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
 enum LogType
 {
     INFO,
@@ -23,16 +33,378 @@ inline const char *convertLogType(LogType type)
     }
 }
 
-void log(string msg, LogType type)
+/**
+ * @brief How important a message is, LogType isn't declared in that order
+ */
+inline int logSeverity(LogType type)
+{
+    switch (type)
+    {
+    case DEBUG:
+        return 0;
+    case INFO:
+        return 1;
+    case WARN:
+        return 2;
+    default:
+        return 3;
+    }
+}
+
+// Messages below this severity are dropped, INT_MAX disables logging
+int logThreshold = INT_MAX;
+
+inline bool logEnabled(LogType type)
+{
+    return logSeverity(type) >= logThreshold;
+}
+
+/**
+ * @brief Apply --debug and log-level= once the config is parsed
+ */
+void setLogLevel(const Config &config)
+{
+    static const map<string, LogType> levels = {
+        {"debug", LogType::DEBUG}, {"info", LogType::INFO},
+        {"warn", LogType::WARN}, {"error", LogType::ERROR}};
+
+    auto it = levels.find(config.logLevel);
+    logThreshold = config.debug ? logSeverity(LogType::DEBUG)
+                   : it != levels.end() ? logSeverity(it->second)
+                                        : INT_MAX;
+}
+
+/**
+ * @brief Bytes one thread logged that the writer hasn't picked up yet.
+ * Single producer, single consumer, so neither side ever takes a lock.
+ * Records are a 32 bit length followed by the formatted line.
+ */
+struct LogRing
+{
+    static constexpr size_t capacity = 16384;
+
+    char buf[capacity];
+    atomic<size_t> head{0}; // written by the producer
+    atomic<size_t> tail{0}; // written by the writer
+    atomic<unsigned long> dropped{0};
+    atomic<bool> orphaned{false}; // the thread exited, remove once drained
+
+    /**
+     * @brief Append a line, dropping it if the writer fell too far behind
+     */
+    bool push(const string &line)
+    {
+        uint32_t length = line.size();
+        size_t h = head.load(memory_order_relaxed);
+        size_t t = tail.load(memory_order_acquire);
+
+        if (capacity - (h - t) < sizeof(length) + length)
+        {
+            dropped.fetch_add(1, memory_order_relaxed);
+            return false;
+        }
+
+        copyIn(h, (const char *)&length, sizeof(length));
+        copyIn(h + sizeof(length), line.data(), length);
+        head.store(h + sizeof(length) + length, memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Move every complete record to out
+     */
+    void drain(string &out)
+    {
+        size_t t = tail.load(memory_order_relaxed);
+        size_t h = head.load(memory_order_acquire);
+
+        while (t != h)
+        {
+            uint32_t length;
+            copyOut(t, (char *)&length, sizeof(length));
+            size_t start = out.size();
+            out.resize(start + length);
+            copyOut(t + sizeof(length), &out[start], length);
+            t += sizeof(length) + length;
+        }
+
+        tail.store(t, memory_order_release);
+    }
+
+    void copyIn(size_t pos, const char *data, size_t size)
+    {
+        size_t offset = pos % capacity;
+        size_t first = min(size, capacity - offset);
+        memcpy(buf + offset, data, first);
+        memcpy(buf, data + first, size - first);
+    }
+
+    void copyOut(size_t pos, char *data, size_t size) const
+    {
+        size_t offset = pos % capacity;
+        size_t first = min(size, capacity - offset);
+        memcpy(data, buf + offset, first);
+        memcpy(data + first, buf, size - first);
+    }
+};
+
+/**
+ * @brief Writes what the threads logged to a rotating file from a background thread.
+ * Producers only copy into their own ring and wake the writer if it's asleep,
+ * so logging never blocks on the disk (or on a terminal).
+ */
+struct LogWriter
+{
+    static constexpr off_t maxFileSize = 1024 * 1024;
+
+    string path;
+    int fd = -1;
+    off_t fileSize = 0;
+    bool echo = false; // also write to stdout, when it's a terminal
+
+    mutex ringsLock; // only taken to add a thread's ring and by the writer
+    vector<shared_ptr<LogRing>> rings;
+
+    atomic<uint32_t> seq{0}; // bumped on every push, the writer sleeps on it
+    atomic<bool> sleeping{false};
+    atomic<bool> running{false};
+    thread worker;
+
+    ~LogWriter()
+    {
+        stop();
+    }
+
+    /**
+     * @brief Open the log file and start the writer thread.
+     * Must run after daemonize(), threads don't survive the fork.
+     */
+    bool start(const string &file)
+    {
+        path = file;
+        if (!openFile())
+        {
+            return false;
+        }
+
+        echo = isatty(STDOUT_FILENO);
+        running = true;
+
+        // The writer inherits our mask, with everything blocked no signal can land there
+        sigset_t all, previous;
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, &previous);
+        worker = thread([this]()
+                        { run(); });
+        pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+        return true;
+    }
+
+    void stop()
+    {
+        if (!running.exchange(false))
+        {
+            return;
+        }
+
+        wake();
+        worker.join();
+        if (fd != -1)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    bool openFile()
+    {
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        struct stat st;
+        fileSize = fstat(fd, &st) == 0 ? st.st_size : 0;
+        return true;
+    }
+
+    /**
+     * @brief Keep the current file and one previous one
+     */
+    void rotate()
+    {
+        close(fd);
+        rename(path.c_str(), (path + ".1").c_str());
+        openFile();
+    }
+
+    void push(const string &line)
+    {
+        thread_local struct Owner
+        {
+            shared_ptr<LogRing> ring;
+            ~Owner()
+            {
+                if (ring)
+                {
+                    ring->orphaned = true;
+                }
+            }
+        } owner;
+
+        if (!owner.ring)
+        {
+            owner.ring = make_shared<LogRing>();
+            lock_guard<mutex> guard(ringsLock);
+            rings.push_back(owner.ring);
+        }
+
+        if (owner.ring->push(line))
+        {
+            seq.fetch_add(1);
+            if (sleeping.load())
+            {
+                wake();
+            }
+        }
+    }
+
+    void wake()
+    {
+        seq.fetch_add(1);
+        syscall(SYS_futex, &seq, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+
+    void run()
+    {
+        string out;
+
+        while (true)
+        {
+            uint32_t seen = seq.load();
+            bool wasRunning = running.load();
+
+            out.clear();
+            unsigned long dropped = 0;
+            {
+                lock_guard<mutex> guard(ringsLock);
+                for (auto it = rings.begin(); it != rings.end();)
+                {
+                    (*it)->drain(out);
+                    dropped += (*it)->dropped.exchange(0, memory_order_relaxed);
+                    // Checked after draining, the thread may have logged right before exiting
+                    it = (*it)->orphaned && (*it)->head == (*it)->tail ? rings.erase(it) : it + 1;
+                }
+            }
+
+            if (dropped)
+            {
+                out += "WARN: " + to_string(dropped) + " log messages dropped\n";
+            }
+            write(out);
+
+            if (!wasRunning)
+            {
+                return;
+            }
+
+            // Sleeps only while nothing was pushed since seen was read
+            sleeping = true;
+            if (seq.load() == seen)
+            {
+                syscall(SYS_futex, &seq, FUTEX_WAIT_PRIVATE, seen, nullptr, nullptr, 0);
+            }
+            sleeping = false;
+        }
+    }
+
+    void write(const string &out)
+    {
+        if (out.empty())
+        {
+            return;
+        }
+
+        if (echo)
+        {
+            (void)!::write(STDOUT_FILENO, out.data(), out.size());
+        }
+
+        if (fd == -1)
+        {
+            return;
+        }
+
+        if (fileSize + (off_t)out.size() > maxFileSize)
+        {
+            rotate();
+        }
+
+        ssize_t n = ::write(fd, out.data(), out.size());
+        fileSize += max(n, (ssize_t)0);
+    }
+};
+
+LogWriter logWriter;
+
+/**
+ * @brief Where the log file goes, $XDG_STATE_HOME/brpc/brpc.log
+ * @return Empty string if there is no home directory
+ */
+string logFilePath()
+{
+    const char *state = getenv("XDG_STATE_HOME");
+    const char *home = getenv("HOME");
+
+    string dir;
+    if (state && *state)
+    {
+        dir = string(state) + "/brpc";
+    }
+    else if (home && *home)
+    {
+        dir = string(home) + "/.local/state/brpc";
+    }
+    else
+    {
+        return "";
+    }
+
+    error_code ec;
+    fs::create_directories(dir, ec);
+    return dir + "/brpc.log";
+}
+
+/**
+ * @brief Format and hand a message to the writer thread.
+ * Until the writer is started (before daemonizing) messages go straight to stdout.
+ * Call through LOG(), so the message isn't even built when the level is disabled.
+ */
+void logWrite(const string &msg, LogType type)
 {
-    if (config.debug)
+    time_t now;
+    time(&now);
+    char buf[sizeof "0000-00-00T00:00:00Z"];
+    strftime(buf, sizeof buf, "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    // build a string to avoid multi threaded mess
+    string out = string(buf) + " " + convertLogType(type) + ": " + msg + "\n";
+
+    if (logWriter.running)
+    {
+        logWriter.push(out);
+    }
+    else
     {
-        time_t now;
-        time(&now);
-        char buf[sizeof "0000-00-00T00:00:00Z"];
-        strftime(buf, sizeof buf, "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
-        // build a string to avoid multi threaded mess
-        string out = string(buf) + " " + convertLogType(type) + ": " + msg + "\n";
         cout << out;
     }
 }
+
+#define LOG(msg, type)                  \
+    do                                  \
+    {                                   \
+        if (logEnabled(type))           \
+        {                               \
+            logWrite((msg), (type));    \
+        }                               \
+    } while (0)
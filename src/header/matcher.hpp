@@ -0,0 +1,368 @@
+#pragma once
+
+#include <list>
+#include <functional>
+#include <unordered_map>
+
+/**
+ * @brief Small least-recently-used cache
+ */
+template <typename K, typename V>
+struct LruCache
+{
+    size_t capacity;
+    list<pair<K, V>> items; // most recently used first
+    unordered_map<K, typename list<pair<K, V>>::iterator> index;
+
+    explicit LruCache(size_t cap) : capacity(cap) {}
+
+    bool get(const K &key, V &value)
+    {
+        auto it = index.find(key);
+        if (it == index.end())
+        {
+            return false;
+        }
+
+        items.splice(items.begin(), items, it->second);
+        value = it->second->second;
+        return true;
+    }
+
+    void put(const K &key, const V &value)
+    {
+        auto it = index.find(key);
+        if (it != index.end())
+        {
+            it->second->second = value;
+            items.splice(items.begin(), items, it->second);
+            return;
+        }
+
+        if (items.size() >= capacity)
+        {
+            index.erase(items.back().first);
+            items.pop_back();
+        }
+
+        items.emplace_front(key, value);
+        index[key] = items.begin();
+    }
+
+    void clear()
+    {
+        items.clear();
+        index.clear();
+    }
+};
+
+/**
+ * @brief Resolves names to asset keys.
+ * Exact names and patterns without regex syntax are hash lookups. The other patterns
+ * are bucketed by the literal text they start with, so a name is only matched against
+ * the few patterns whose prefix it shares, plus the ones that don't start with a literal.
+ */
+struct AssetMatcher
+{
+    // One top-level alternative of a pattern, tried on its own
+    struct Entry
+    {
+        size_t order; // index of the pattern it came from, lower wins
+        regex re;
+    };
+
+    // Consulted before the exact names, e.g. to look names up in the asset index
+    function<bool(const string &, string &)> lookup;
+    unordered_map<string, string> exact;
+
+    vector<string> patterns;
+    vector<string> values;
+
+    unordered_map<string, size_t> literals;            // pattern that is plain text -> order
+    vector<Entry> entries;
+    unordered_map<string, vector<size_t>> byPrefix;    // literal prefix -> entries, in order
+    vector<size_t> prefixLengths;                      // every prefix length in byPrefix, ascending
+    vector<size_t> unprefixed;                         // entries that can start with anything
+    bool compiled = false;
+
+    void addExact(const string &name, const string &value)
+    {
+        exact[name] = value;
+    }
+
+    /**
+     * @brief Patterns are tried in the order they were added
+     */
+    void addPattern(const string &pattern, const string &value)
+    {
+        patterns.push_back(pattern);
+        values.push_back(value);
+        compiled = false;
+    }
+
+    /**
+     * @brief Split a pattern on the | that aren't inside a group or a bracket expression
+     */
+    static vector<string> alternatives(const string &pattern)
+    {
+        vector<string> out;
+        size_t start = 0;
+        int depth = 0;
+        bool bracket = false;
+
+        for (size_t i = 0; i < pattern.size(); i++)
+        {
+            char c = pattern[i];
+            if (c == '\\')
+            {
+                i++;
+            }
+            else if (bracket)
+            {
+                bracket = c != ']';
+            }
+            else if (c == '[')
+            {
+                bracket = true;
+            }
+            else if (c == '(')
+            {
+                depth++;
+            }
+            else if (c == ')')
+            {
+                depth--;
+            }
+            else if (c == '|' && depth == 0)
+            {
+                out.push_back(pattern.substr(start, i - start));
+                start = i + 1;
+            }
+        }
+        out.push_back(pattern.substr(start));
+        return out;
+    }
+
+    /**
+     * @brief Text every match of the pattern starts with
+     * @param whole set to true if the pattern is nothing but that text
+     */
+    static string literalPrefix(const string &pattern, bool &whole)
+    {
+        string prefix;
+        whole = false;
+
+        for (size_t i = 0; i < pattern.size();)
+        {
+            char c = pattern[i];
+            size_t next = i + 1;
+            if (c == '\\')
+            {
+                // \d, \w, \b, backreferences and the like aren't literals
+                if (next == pattern.size() || isalnum((unsigned char)pattern[next]))
+                {
+                    return prefix;
+                }
+                c = pattern[next++];
+            }
+            else if (strchr(".[](){}*+?|^$", c))
+            {
+                return prefix;
+            }
+
+            // A quantified character may be missing or repeated, it ends the prefix
+            if (next < pattern.size() && strchr("?*{", pattern[next]))
+            {
+                return prefix;
+            }
+            prefix += c;
+            if (next < pattern.size() && pattern[next] == '+')
+            {
+                return prefix;
+            }
+            i = next;
+        }
+
+        whole = true;
+        return prefix;
+    }
+
+    void compile()
+    {
+        literals.clear();
+        entries.clear();
+        byPrefix.clear();
+        prefixLengths.clear();
+        unprefixed.clear();
+
+        for (size_t i = 0; i < patterns.size(); i++)
+        {
+            try
+            {
+                regex validate(patterns[i]);
+            }
+            catch (const regex_error &ex)
+            {
+                LOG("Invalid pattern \"" + patterns[i] + "\": " + ex.what(), LogType::WARN);
+                patterns.erase(patterns.begin() + i);
+                values.erase(values.begin() + i);
+                i--;
+                continue;
+            }
+
+            if (!addAlternatives(i))
+            {
+                // Valid as a whole only, so it can't be bucketed
+                entries.push_back({i, regex(patterns[i])});
+                unprefixed.push_back(entries.size() - 1);
+            }
+        }
+
+        sort(prefixLengths.begin(), prefixLengths.end());
+        compiled = true;
+    }
+
+    /**
+     * @brief Index the top-level alternatives of a pattern on their own
+     * @return false, without adding anything, if an alternative doesn't stand alone
+     */
+    bool addAlternatives(size_t order)
+    {
+        const string &pattern = patterns[order];
+
+        // Group numbers change once the alternatives are split, a backreference may then point elsewhere
+        for (size_t i = 0; i + 1 < pattern.size(); i++)
+        {
+            if (pattern[i] == '\\' && pattern[i + 1] >= '1' && pattern[i + 1] <= '9')
+            {
+                return false;
+            }
+            i += pattern[i] == '\\';
+        }
+
+        vector<pair<string, bool>> split; // prefix, whole
+        vector<Entry> compiledAlternatives;
+        for (const auto &alternative : alternatives(pattern))
+        {
+            bool whole;
+            string prefix = literalPrefix(alternative, whole);
+            if (!whole)
+            {
+                try
+                {
+                    compiledAlternatives.push_back({order, regex(alternative)});
+                }
+                catch (const regex_error &)
+                {
+                    return false;
+                }
+            }
+            split.emplace_back(move(prefix), whole);
+        }
+
+        auto next = compiledAlternatives.begin();
+        for (auto &item : split)
+        {
+            string &prefix = item.first;
+            if (item.second)
+            {
+                // Earlier patterns win, so the first one to claim a name keeps it
+                literals.emplace(prefix, order);
+                continue;
+            }
+
+            entries.push_back(move(*next++));
+            if (prefix.empty())
+            {
+                unprefixed.push_back(entries.size() - 1);
+                continue;
+            }
+
+            byPrefix[prefix].push_back(entries.size() - 1);
+            if (find(prefixLengths.begin(), prefixLengths.end(), prefix.size()) == prefixLengths.end())
+            {
+                prefixLengths.push_back(prefix.size());
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Lower the best order found so far to the first entry of candidates matching name
+     */
+    void tryEntries(const string &name, const vector<size_t> &candidates, size_t &best) const
+    {
+        for (size_t index : candidates)
+        {
+            const Entry &entry = entries[index];
+            if (entry.order >= best)
+            {
+                return;
+            }
+            if (regex_match(name, entry.re))
+            {
+                best = entry.order;
+                return;
+            }
+        }
+    }
+
+    /**
+     * @return true and the asset key in value if name matched anything
+     */
+    bool match(const string &name, string &value)
+    {
+        if (lookup && lookup(name, value))
+        {
+            return true;
+        }
+
+        auto it = exact.find(name);
+        if (it != exact.end())
+        {
+            value = it->second;
+            return true;
+        }
+
+        if (patterns.empty())
+        {
+            return false;
+        }
+
+        if (!compiled)
+        {
+            compile();
+        }
+
+        size_t best = patterns.size();
+        auto literal = literals.find(name);
+        if (literal != literals.end())
+        {
+            best = literal->second;
+        }
+
+        // Only patterns added before the best match so far can still beat it
+        string prefix;
+        for (size_t length : prefixLengths)
+        {
+            if (length > name.size())
+            {
+                break;
+            }
+            prefix.assign(name, 0, length);
+            auto bucket = byPrefix.find(prefix);
+            if (bucket != byPrefix.end())
+            {
+                tryEntries(name, bucket->second, best);
+            }
+        }
+        tryEntries(name, unprefixed, best);
+
+        if (best == patterns.size())
+        {
+            return false;
+        }
+        value = values[best];
+        return true;
+    }
+};
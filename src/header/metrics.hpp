@@ -0,0 +1,148 @@
+#pragma once
+
+#include <atomic>
+#include <climits>
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+
+/**
+ * @brief One CPU/RAM sample, what the presence is built from
+ */
+struct MetricsSnapshot
+{
+    float cpu = -1;
+    float mem = -1;
+    long sampledAtNs = 0; // CLOCK_MONOTONIC
+
+    bool valid() const
+    {
+        return cpu != -1 && mem != -1;
+    }
+};
+
+/**
+ * @brief Latest metrics sample, published through a seqlock.
+ * There is a single writer; readers never block it and retry if they raced with a write,
+ * so every reader sees a whole sample. The sequence number doubles as a generation counter:
+ * consumers can wait on the futex until it moves, or watch the eventfd from the reactor.
+ */
+struct MetricsChannel
+{
+    // Odd while a write is in progress, generation() == seq / 2
+    atomic<uint32_t> seq{0};
+
+    // Fields are atomics only to make the racing reads defined, the seqlock provides consistency
+    atomic<float> cpu{-1};
+    atomic<float> mem{-1};
+    atomic<long> sampledAtNs{0};
+
+    int fd = -1; // eventfd, readable after every publish
+
+    MetricsChannel()
+    {
+        fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+
+    ~MetricsChannel()
+    {
+        if (fd != -1)
+        {
+            close(fd);
+        }
+    }
+
+    MetricsChannel(const MetricsChannel &) = delete;
+    MetricsChannel &operator=(const MetricsChannel &) = delete;
+
+    void publish(const MetricsSnapshot &snapshot)
+    {
+        uint32_t s = seq.load(memory_order_relaxed);
+        seq.store(s + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+
+        cpu.store(snapshot.cpu, memory_order_relaxed);
+        mem.store(snapshot.mem, memory_order_relaxed);
+        sampledAtNs.store(snapshot.sampledAtNs, memory_order_relaxed);
+
+        seq.store(s + 2, memory_order_release);
+
+        syscall(SYS_futex, &seq, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+        if (fd != -1)
+        {
+            uint64_t one = 1;
+            (void)!write(fd, &one, sizeof(one));
+        }
+    }
+
+    /**
+     * @brief Copy the latest sample
+     * @return Its generation, 0 if nothing was published yet
+     */
+    uint32_t read(MetricsSnapshot &snapshot) const
+    {
+        uint32_t before, after;
+        do
+        {
+            before = seq.load(memory_order_acquire);
+            if (before & 1)
+            {
+                continue;
+            }
+
+            snapshot.cpu = cpu.load(memory_order_relaxed);
+            snapshot.mem = mem.load(memory_order_relaxed);
+            snapshot.sampledAtNs = sampledAtNs.load(memory_order_relaxed);
+
+            atomic_thread_fence(memory_order_acquire);
+            after = seq.load(memory_order_relaxed);
+        } while ((before & 1) || before != after);
+
+        return before / 2;
+    }
+
+    uint32_t generation() const
+    {
+        return seq.load(memory_order_acquire) / 2;
+    }
+
+    /**
+     * @brief Block until a sample newer than seen is published
+     * @param timeoutMs -1 to wait forever
+     * @return false on timeout
+     */
+    bool wait(uint32_t seen, long timeoutMs = -1) const
+    {
+        struct timespec timeout;
+        if (timeoutMs >= 0)
+        {
+            timeout.tv_sec = timeoutMs / 1000;
+            timeout.tv_nsec = (timeoutMs % 1000) * 1000000L;
+        }
+
+        while (true)
+        {
+            uint32_t s = seq.load(memory_order_acquire);
+            if (s / 2 != seen && !(s & 1))
+            {
+                return true;
+            }
+
+            // Sleeps only while seq still holds s, so a publish in between can't be missed
+            long ret = syscall(SYS_futex, &seq, FUTEX_WAIT_PRIVATE, s, timeoutMs >= 0 ? &timeout : nullptr, nullptr, 0);
+            if (ret == -1 && errno == ETIMEDOUT)
+            {
+                return false;
+            }
+        }
+    }
+
+    /**
+     * @brief Reset the eventfd after it became readable
+     */
+    void acknowledge()
+    {
+        uint64_t count;
+        (void)!::read(fd, &count, sizeof(count));
+    }
+};
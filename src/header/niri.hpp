@@ -0,0 +1,211 @@
+#pragma once
+
+#include <unordered_map>
+
+/**
+ * @brief Subscription to niri's event stream.
+ * niri sends the full window list once and then only what changes, one JSON object per
+ * line, so the focused window is followed without sending another request.
+ */
+struct NiriEvents : CompositorBackend
+{
+    struct Window
+    {
+        string appId;
+        string title;
+        int pid = 0;
+    };
+
+    string in; // received bytes that don't form a complete line yet
+    unordered_map<long long, Window> windows;
+    long long focusedId = -1;
+
+    const char *name() const override
+    {
+        return "niri";
+    }
+
+    bool subscribe() override
+    {
+        const char *path = getenv("NIRI_SOCKET");
+        fd = path && *path ? connectUnixSocket(path, false) : -1;
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        struct timeval timeout = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        const char request[] = "\"EventStream\"\n";
+        if (send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL) != (ssize_t)sizeof(request) - 1)
+        {
+            return false;
+        }
+
+        windows.clear();
+        focusedId = -1;
+        in.clear();
+
+        // The reply comes first, then the initial state. Wait for the window list so that
+        // the focus is known when we return, like with the other backends.
+        bool replied = false;
+        char chunk[4096];
+        while (true)
+        {
+            size_t newline;
+            while ((newline = in.find('\n')) != string::npos)
+            {
+                string line = in.substr(0, newline);
+                in.erase(0, newline + 1);
+
+                if (!replied)
+                {
+                    if (line.compare(0, 5, "{\"Ok\"") != 0)
+                    {
+                        LOG("niri refused the event stream: " + line, LogType::ERROR);
+                        return false;
+                    }
+                    replied = true;
+                }
+                else if (handleEvent(line) == "WindowsChanged")
+                {
+                    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                    refresh();
+                    return true;
+                }
+            }
+
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0)
+            {
+                if (n == -1 && errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            in.append(chunk, n);
+        }
+    }
+
+    bool dispatch() override
+    {
+        if (fd == -1 && !reconnect())
+        {
+            return false;
+        }
+
+        string previousClass = activeClass;
+        string previousTitle = activeTitle;
+
+        bool alive = receive(in);
+
+        size_t start = 0;
+        size_t newline;
+        while ((newline = in.find('\n', start)) != string::npos)
+        {
+            handleEvent(in.substr(start, newline - start));
+            start = newline + 1;
+        }
+        in.erase(0, start);
+
+        if (!alive)
+        {
+            in.clear();
+            reconnect();
+        }
+        else
+        {
+            refresh();
+        }
+
+        return activeClass != previousClass || (watchTitle && activeTitle != previousTitle);
+    }
+
+    static Window parseWindow(const string &json)
+    {
+        Window window;
+        long long pid = 0;
+        jsonGetString(json, "app_id", window.appId);
+        jsonGetString(json, "title", window.title);
+        window.pid = jsonGetInt(json, "pid", pid) ? pid : 0;
+        return window;
+    }
+
+    /**
+     * @brief Apply one event line to the window list
+     * @return The event's name
+     */
+    string handleEvent(const string &line)
+    {
+        // Every event is an object with a single key, named after the event
+        size_t begin = line.find('"');
+        size_t end = begin == string::npos ? string::npos : line.find('"', begin + 1);
+        if (end == string::npos)
+        {
+            return "";
+        }
+        string event = line.substr(begin + 1, end - begin - 1);
+
+        long long id = -1;
+        if (event == "WindowsChanged")
+        {
+            windows.clear();
+            focusedId = -1;
+            jsonForEach(line, "windows", [this](const string &window)
+                        {
+                            long long windowId = -1;
+                            if (!jsonGetInt(window, "id", windowId))
+                            {
+                                return;
+                            }
+                            windows[windowId] = parseWindow(window);
+                            if (jsonGetBool(window, "is_focused"))
+                            {
+                                focusedId = windowId;
+                            }
+                        });
+        }
+        else if (event == "WindowOpenedOrChanged" && jsonGetInt(line, "id", id))
+        {
+            windows[id] = parseWindow(line);
+            if (jsonGetBool(line, "is_focused"))
+            {
+                focusedId = id;
+            }
+        }
+        else if (event == "WindowClosed" && jsonGetInt(line, "id", id))
+        {
+            windows.erase(id);
+            if (id == focusedId)
+            {
+                focusedId = -1;
+            }
+        }
+        else if (event == "WindowFocusChanged")
+        {
+            // The id is null when nothing has the focus
+            focusedId = jsonGetInt(line, "id", id) ? id : -1;
+        }
+        return event;
+    }
+
+    /**
+     * @brief Take the active window from the focused entry of the window list
+     */
+    void refresh()
+    {
+        auto it = windows.find(focusedId);
+        if (it == windows.end())
+        {
+            activeClass = "";
+            activeTitle = "";
+            activePid = 0;
+            return;
+        }
+        activeClass = it->second.appId;
+        activeTitle = it->second.title;
+        activePid = it->second.pid;
+    }
+};
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <fcntl.h>
+
+/**
+ * @brief Where procfs is mounted. Can be pointed at a fixture tree with BRPC_PROC_ROOT,
+ * which the benchmarks use to simulate large machines.
+ */
+string procRoot = getenv("BRPC_PROC_ROOT") ? getenv("BRPC_PROC_ROOT") : "/proc";
+
+/**
+ * @brief Where the cgroup v2 hierarchy is mounted, BRPC_CGROUP_ROOT points it at a fixture
+ */
+string cgroupRoot = getenv("BRPC_CGROUP_ROOT") ? getenv("BRPC_CGROUP_ROOT") : "/sys/fs/cgroup";
+
+/**
+ * @brief A /proc file that stays open and is re-read with pread.
+ * procfs regenerates the content on every read from offset 0,
+ * so there is no need to reopen it for each sample.
+ */
+struct ProcFile
+{
+    const char *name; // relative to procRoot
+    int fd = -1;
+
+    explicit ProcFile(const char *n) : name(n) {}
+
+    ~ProcFile()
+    {
+        reset();
+    }
+
+    /**
+     * @brief Close the file, it is reopened on the next read
+     */
+    void reset()
+    {
+        if (fd != -1)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    ProcFile(const ProcFile &) = delete;
+    ProcFile &operator=(const ProcFile &) = delete;
+
+    /**
+     * @brief Read the file into buf and NUL terminate it
+     * @return Number of bytes read, -1 on error
+     */
+    ssize_t read(char *buf, size_t size)
+    {
+        if (fd == -1)
+        {
+            fd = open((procRoot + "/" + name).c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1)
+            {
+                return -1;
+            }
+        }
+
+        ssize_t n = pread(fd, buf, size - 1, 0);
+        if (n < 0)
+        {
+            close(fd);
+            fd = -1;
+            return -1;
+        }
+
+        buf[n] = '\0';
+        stats.procBytes.fetch_add(n, memory_order_relaxed);
+        return n;
+    }
+};
+
+inline const char *skipSpaces(const char *p)
+{
+    while (*p == ' ' || *p == '\t')
+    {
+        p++;
+    }
+    return p;
+}
+
+/**
+ * @brief Parse an unsigned decimal number and advance p past it
+ */
+inline unsigned long long scanNumber(const char *&p)
+{
+    p = skipSpaces(p);
+
+    unsigned long long value = 0;
+    while (*p >= '0' && *p <= '9')
+    {
+        value = value * 10 + (*p - '0');
+        p++;
+    }
+    return value;
+}
+
+/**
+ * @brief Parse a non-negative decimal with an optional fraction, like the ones in /proc/uptime
+ */
+inline double scanDecimal(const char *&p)
+{
+    double value = scanNumber(p);
+
+    if (*p == '.')
+    {
+        p++;
+        double scale = 0.1;
+        while (*p >= '0' && *p <= '9')
+        {
+            value += (*p - '0') * scale;
+            scale /= 10;
+            p++;
+        }
+    }
+    return value;
+}
+
+/**
+ * @brief Find a line starting with key
+ * @return Pointer right after the key, or nullptr
+ */
+inline const char *findLine(const char *buf, const char *key)
+{
+    size_t keyLength = strlen(key);
+    const char *line = buf;
+
+    while (*line)
+    {
+        if (strncmp(line, key, keyLength) == 0)
+        {
+            return line + keyLength;
+        }
+
+        line = strchr(line, '\n');
+        if (!line)
+        {
+            break;
+        }
+        line++;
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Value of a "Key: 1234 kB" style line, 0 if the key doesn't exist
+ */
+inline unsigned long long scanKey(const char *buf, const char *key)
+{
+    const char *p = findLine(buf, key);
+    return p ? scanNumber(p) : 0;
+}
+
+ProcFile procStat("stat");
+ProcFile procMeminfo("meminfo");
+ProcFile procUptime("uptime");
+
+/**
+ * @brief Switch to another procfs root, reopening the persistent files
+ */
+void setProcRoot(const string &root)
+{
+    procRoot = root;
+    procStat.reset();
+    procMeminfo.reset();
+    procUptime.reset();
+}
@@ -0,0 +1,571 @@
+#pragma once
+
+#include <unordered_map>
+#include <unordered_set>
+
+/**
+ * @brief Resource usage of the focused application, children included
+ */
+struct AppUsage
+{
+    float cpu = -1; // percent of one core, like top
+    unsigned long long rssKb = 0;
+
+    bool valid() const
+    {
+        return cpu != -1;
+    }
+
+    /**
+     * @brief Like "CPU 12% | 1.4 GB"
+     */
+    string text() const
+    {
+        char buf[64];
+        if (rssKb >= 1024 * 1024)
+        {
+            snprintf(buf, sizeof(buf), "CPU %ld%% | %.1f GB", (long)cpu, rssKb / (1024.0 * 1024.0));
+        }
+        else
+        {
+            snprintf(buf, sizeof(buf), "CPU %ld%% | %llu MB", (long)cpu, rssKb / 1024);
+        }
+        return buf;
+    }
+};
+
+/**
+ * @brief Samples CPU time and RSS of a process and its descendants.
+ *
+ * Applications launched into a cgroup of their own (the app-*.scope units of desktop
+ * launchers, flatpak and snap) are read from that cgroup's cpu.stat and memory.stat: two
+ * preads per tick, however many processes the application spawns. That needs every process
+ * in the cgroup to descend from the root, a shared session scope falls back to the tree.
+ *
+ * Otherwise /proc/<pid>/stat and statm stay open for every process of the tree, so a tick
+ * costs two preads per process of the tree and never walks /proc. The parent -> children
+ * index that finds the descendants is rebuilt when the root changes or it gets older than
+ * indexMaxAgeNs (to pick up new children). Exits drop the process right away, but rebuild
+ * the index at most every indexMinIntervalNs, so applications that churn through child
+ * processes don't walk /proc on every tick.
+ */
+struct ProcessTreeSampler
+{
+    struct Tracked
+    {
+        int statFd = -1;
+        int statmFd = -1;
+        unsigned long long ticks = 0;
+        bool seen = false;
+    };
+
+    static constexpr long indexMaxAgeNs = 30 * 1000000000L;
+    static constexpr long indexMinIntervalNs = 5 * 1000000000L;
+
+    int rootPid = 0;
+    unordered_map<int, Tracked> tracked;
+    ProcessScanner lister{{}}; // only used to list /proc
+    long indexBuiltNs = 0; // 0 forces a rebuild
+    bool indexDirty = false; // a tracked process exited since the last rebuild
+
+    // cpu.stat and memory.stat of the root's cgroup, when it holds nothing but the application
+    int cgroupCpuFd = -1;
+    int cgroupMemFd = -1;
+    unsigned long long cgroupUsec = 0;
+
+    long lastSampleNs = 0;
+    bool primed = false;
+    long ticksPerSecond = sysconf(_SC_CLK_TCK);
+    long pageKb = sysconf(_SC_PAGESIZE) / 1024;
+
+    ~ProcessTreeSampler()
+    {
+        closeAllTracked();
+        closeCgroup();
+    }
+
+    bool usingCgroup() const
+    {
+        return cgroupCpuFd != -1;
+    }
+
+    /**
+     * @brief Follow another process tree, 0 to stop sampling
+     */
+    void setRoot(int pid)
+    {
+        if (pid == rootPid)
+        {
+            return;
+        }
+
+        rootPid = pid;
+        indexBuiltNs = 0;
+        indexDirty = false;
+        primed = false;
+        closeCgroup();
+
+        if (rootPid && openCgroup())
+        {
+            closeAllTracked();
+        }
+
+        // Prime the counters, the first usage comes with the next sample
+        if (rootPid)
+        {
+            sample(Timer::nowNs());
+        }
+    }
+
+    /**
+     * @brief CPU usage since the previous call and current RSS of the tree
+     * @return Invalid usage if there is no root or on the first call after setRoot
+     */
+    AppUsage sample(long nowNs)
+    {
+        AppUsage usage;
+        if (!rootPid)
+        {
+            return usage;
+        }
+
+        if (usingCgroup())
+        {
+            return sampleCgroup(nowNs);
+        }
+
+        long age = nowNs - indexBuiltNs;
+        if (indexBuiltNs == 0 || age > indexMaxAgeNs || (indexDirty && age >= indexMinIntervalNs))
+        {
+            rebuild(nowNs);
+        }
+
+        unsigned long long deltaTicks = 0;
+        unsigned long long rssPages = 0;
+        char buf[1024];
+
+        for (auto it = tracked.begin(); it != tracked.end();)
+        {
+            Tracked &t = it->second;
+            unsigned long long ticks, pages;
+
+            if (!readTicks(t.statFd, buf, sizeof(buf), ticks) || !readResident(t.statmFd, buf, sizeof(buf), pages))
+            {
+                // Exited, its last slice of CPU time is lost, and the index may miss new children.
+                // The rebuild is rate limited, processes started meanwhile only count later.
+                closeTracked(t);
+                it = tracked.erase(it);
+                indexDirty = true;
+                continue;
+            }
+
+            // Processes found by a rebuild only count from their second read on
+            deltaTicks += t.seen ? ticks - min(ticks, t.ticks) : 0;
+            t.ticks = ticks;
+            t.seen = true;
+            rssPages += pages;
+            it++;
+        }
+
+        usage.rssKb = rssPages * pageKb;
+        if (primed && nowNs > lastSampleNs)
+        {
+            double seconds = (nowNs - lastSampleNs) / 1e9;
+            usage.cpu = deltaTicks / (seconds * ticksPerSecond) * 100;
+        }
+
+        lastSampleNs = nowNs;
+        primed = !tracked.empty();
+        return usage;
+    }
+
+    /**
+     * @brief CPU and memory of the root's cgroup, children included by the kernel
+     */
+    AppUsage sampleCgroup(long nowNs)
+    {
+        AppUsage usage;
+        char buf[4096];
+        unsigned long long usec, anon, mapped;
+
+        if (readFd(cgroupCpuFd, buf, sizeof(buf)) < 0 || !statValue(buf, "usage_usec", usec) ||
+            readFd(cgroupMemFd, buf, sizeof(buf)) < 0 || !statValue(buf, "anon", anon) || !statValue(buf, "file_mapped", mapped))
+        {
+            // The scope goes away with the application
+            closeCgroup();
+            primed = false;
+            return usage;
+        }
+
+        // Resident like RSS: anonymous memory plus mapped files, not the page cache memory.current counts
+        usage.rssKb = (anon + mapped) / 1024;
+        if (primed && nowNs > lastSampleNs)
+        {
+            double seconds = (nowNs - lastSampleNs) / 1e9;
+            usage.cpu = (usec - min(usec, cgroupUsec)) / (seconds * 1e6) * 100;
+        }
+
+        cgroupUsec = usec;
+        lastSampleNs = nowNs;
+        primed = true;
+        return usage;
+    }
+
+    /**
+     * @brief Use the root's cgroup if the application has one to itself
+     * @return false if it shares one, e.g. with the terminal it was started from
+     */
+    bool openCgroup()
+    {
+        string path, parentPath;
+        char buf[1024];
+        int ppid = 0;
+
+        int fd = openProcFile(rootPid, "stat");
+        bool haveParent = fd != -1 && readParent(fd, buf, sizeof(buf), ppid);
+        if (fd != -1)
+        {
+            close(fd);
+        }
+
+        // Its parent being in the same cgroup means the cgroup holds more than this tree
+        if (!haveParent || !readCgroup(rootPid, path) || path == "/" ||
+            (readCgroup(ppid, parentPath) && parentPath == path))
+        {
+            return false;
+        }
+
+        // A WM that double-forks what it starts leaves the app in its session scope, next to
+        // processes of its own that aren't the app's parent, so check what the cgroup holds
+        if (!holdsOnlyTree(cgroupRoot + path))
+        {
+            return false;
+        }
+
+        cgroupCpuFd = open((cgroupRoot + path + "/cpu.stat").c_str(), O_RDONLY | O_CLOEXEC);
+        cgroupMemFd = open((cgroupRoot + path + "/memory.stat").c_str(), O_RDONLY | O_CLOEXEC);
+        if (cgroupCpuFd == -1 || cgroupMemFd == -1)
+        {
+            // cgroup v1, or no memory controller for this cgroup
+            closeCgroup();
+            return false;
+        }
+
+        LOG("Sampling the cgroup " + path + " of " + to_string(rootPid), LogType::DEBUG);
+        return true;
+    }
+
+    /**
+     * @brief Whether every process of a cgroup and the cgroups below it descends from the root.
+     * Only checked when the cgroup is opened, which is enough to tell a session scope (the WM
+     * and whatever it started are in there first) from a scope the launcher made for the app.
+     */
+    bool holdsOnlyTree(const string &dir)
+    {
+        ifstream procs(dir + "/cgroup.procs");
+        if (!procs)
+        {
+            return false;
+        }
+
+        int pid;
+        while (procs >> pid)
+        {
+            if (!descendsFromRoot(pid))
+            {
+                return false;
+            }
+        }
+
+        error_code ec;
+        for (const auto &entry : fs::directory_iterator(dir, ec))
+        {
+            if (entry.is_directory(ec) && !holdsOnlyTree(entry.path()))
+            {
+                return false;
+            }
+        }
+        return !ec;
+    }
+
+    bool descendsFromRoot(int pid)
+    {
+        char buf[1024];
+        // The depth bound only guards against a corrupt or racing /proc
+        for (int depth = 0; depth < 1024 && pid > 1; depth++)
+        {
+            if (pid == rootPid)
+            {
+                return true;
+            }
+
+            int fd = openProcFile(pid, "stat");
+            bool haveParent = fd != -1 && readParent(fd, buf, sizeof(buf), pid);
+            if (fd != -1)
+            {
+                close(fd);
+            }
+            if (!haveParent)
+            {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Path of the cgroup v2 a process is in, from the "0::" line of /proc/<pid>/cgroup
+     */
+    bool readCgroup(int pid, string &path)
+    {
+        char buf[1024];
+        int fd = openProcFile(pid, "cgroup");
+        if (fd == -1)
+        {
+            return false;
+        }
+        ssize_t n = readFd(fd, buf, sizeof(buf));
+        close(fd);
+        if (n < 0)
+        {
+            return false;
+        }
+
+        for (const char *line = buf; line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : nullptr)
+        {
+            if (strncmp(line, "0::", 3) == 0)
+            {
+                const char *end = strchr(line, '\n');
+                path.assign(line + 3, end ? end - line - 3 : strlen(line + 3));
+                return !path.empty();
+            }
+        }
+        return false;
+    }
+
+    void closeCgroup()
+    {
+        if (cgroupCpuFd != -1)
+        {
+            close(cgroupCpuFd);
+        }
+        if (cgroupMemFd != -1)
+        {
+            close(cgroupMemFd);
+        }
+        cgroupCpuFd = cgroupMemFd = -1;
+        cgroupUsec = 0;
+    }
+
+    int openProcFile(int pid, const char *name)
+    {
+        if (lister.procFd == -1)
+        {
+            lister.procFd = open(procRoot.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        }
+
+        char path[32];
+        snprintf(path, sizeof(path), "%d/%s", pid, name);
+        return openat(lister.procFd, path, O_RDONLY | O_CLOEXEC);
+    }
+
+    /**
+     * @brief Walk /proc once to find the descendants of the root and open the ones not tracked yet
+     */
+    void rebuild(long nowNs)
+    {
+        indexBuiltNs = nowNs;
+        indexDirty = false;
+
+        unordered_map<int, vector<int>> children;
+        if (lister.listPids())
+        {
+            char path[32];
+            char buf[1024];
+            for (int pid : lister.pids)
+            {
+                snprintf(path, sizeof(path), "%d/stat", pid);
+                int fd = openat(lister.procFd, path, O_RDONLY | O_CLOEXEC);
+                if (fd == -1)
+                {
+                    continue;
+                }
+
+                int ppid;
+                if (readParent(fd, buf, sizeof(buf), ppid))
+                {
+                    children[ppid].push_back(pid);
+                }
+                close(fd);
+            }
+        }
+
+        unordered_set<int> tree;
+        vector<int> pending = {rootPid};
+        while (!pending.empty())
+        {
+            int pid = pending.back();
+            pending.pop_back();
+            if (!tree.insert(pid).second)
+            {
+                continue;
+            }
+
+            auto it = children.find(pid);
+            if (it != children.end())
+            {
+                pending.insert(pending.end(), it->second.begin(), it->second.end());
+            }
+        }
+
+        for (auto it = tracked.begin(); it != tracked.end();)
+        {
+            if (tree.count(it->first))
+            {
+                it++;
+                continue;
+            }
+            closeTracked(it->second);
+            it = tracked.erase(it);
+        }
+
+        for (int pid : tree)
+        {
+            if (tracked.count(pid) || lister.procFd == -1)
+            {
+                continue;
+            }
+
+            Tracked t;
+            char path[32];
+            snprintf(path, sizeof(path), "%d/stat", pid);
+            t.statFd = openat(lister.procFd, path, O_RDONLY | O_CLOEXEC);
+            snprintf(path, sizeof(path), "%d/statm", pid);
+            t.statmFd = openat(lister.procFd, path, O_RDONLY | O_CLOEXEC);
+
+            if (t.statFd == -1 || t.statmFd == -1)
+            {
+                closeTracked(t);
+                continue;
+            }
+            tracked[pid] = t;
+        }
+
+        LOG("Sampling " + to_string(tracked.size()) + " processes of the tree of " + to_string(rootPid), LogType::DEBUG);
+    }
+
+    void closeAllTracked()
+    {
+        for (auto &kv : tracked)
+        {
+            closeTracked(kv.second);
+        }
+        tracked.clear();
+    }
+
+    static void closeTracked(Tracked &t)
+    {
+        if (t.statFd != -1)
+        {
+            close(t.statFd);
+        }
+        if (t.statmFd != -1)
+        {
+            close(t.statmFd);
+        }
+        t.statFd = t.statmFd = -1;
+    }
+
+    static ssize_t readFd(int fd, char *buf, size_t size)
+    {
+        ssize_t n = pread(fd, buf, size - 1, 0);
+        if (n <= 0)
+        {
+            return -1;
+        }
+        buf[n] = '\0';
+        stats.procBytes.fetch_add(n, memory_order_relaxed);
+        return n;
+    }
+
+    /**
+     * @brief Skip to the fields after the command name, which may contain spaces and parentheses itself
+     */
+    static const char *afterComm(const char *buf)
+    {
+        const char *p = strrchr(buf, ')');
+        return p ? skipSpaces(p + 1) : nullptr;
+    }
+
+    static bool readParent(int fd, char *buf, size_t size, int &ppid)
+    {
+        const char *p;
+        if (readFd(fd, buf, size) < 0 || !(p = afterComm(buf)) || !*p)
+        {
+            return false;
+        }
+
+        p++; // state
+        ppid = scanNumber(p);
+        return true;
+    }
+
+    /**
+     * @brief utime + stime, fields 14 and 15 of stat
+     */
+    static bool readTicks(int fd, char *buf, size_t size, unsigned long long &ticks)
+    {
+        const char *p;
+        if (readFd(fd, buf, size) < 0 || !(p = afterComm(buf)) || !*p)
+        {
+            return false;
+        }
+
+        // Skipped as words, tpgid is -1 for most processes
+        for (int field = 3; field < 14; field++)
+        {
+            p = skipSpaces(p);
+            while (*p && *p != ' ')
+            {
+                p++;
+            }
+        }
+        ticks = scanNumber(p);
+        ticks += scanNumber(p);
+        return true;
+    }
+
+    /**
+     * @brief Value of a "key value" line of a cgroup stat file
+     */
+    static bool statValue(const char *buf, const char *key, unsigned long long &value)
+    {
+        size_t length = strlen(key);
+        for (const char *line = buf; line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : nullptr)
+        {
+            if (strncmp(line, key, length) == 0 && line[length] == ' ')
+            {
+                const char *p = line + length;
+                value = scanNumber(p);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Resident pages, the second field of statm
+     */
+    static bool readResident(int fd, char *buf, size_t size, unsigned long long &pages)
+    {
+        if (readFd(fd, buf, size) < 0)
+        {
+            return false;
+        }
+
+        const char *p = buf;
+        scanNumber(p);
+        pages = scanNumber(p);
+        return true;
+    }
+};
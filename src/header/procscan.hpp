@@ -0,0 +1,270 @@
+#pragma once
+
+#include <sys/syscall.h>
+#include <mutex>
+
+struct ProcessMatch
+{
+    int pid;
+    size_t pattern; // index into ProcessScanner::patterns
+};
+
+/**
+ * @brief Looks for several process names in a single walk of /proc.
+ * Directory entries come straight from getdents64, cmdlines are read with pread
+ * into reused buffers and every cmdline is matched against all patterns in one pass.
+ * Large process tables are split across worker threads.
+ */
+struct ProcessScanner
+{
+    vector<string> patterns;
+    bool ignoreCase;
+
+    // Bitmask of the patterns starting with each byte, so only candidates are compared
+    uint64_t firstByte[256] = {};
+
+    int procFd = -1;
+    vector<int> pids;
+
+    // Below this many processes threads cost more than they save
+    static constexpr size_t pidsPerShard = 4096;
+    static constexpr size_t maxPatterns = 64;
+    static constexpr size_t cmdlineSize = 4096;
+
+    ProcessScanner(const vector<string> &names, bool icase = true) : ignoreCase(icase)
+    {
+        for (const auto &name : names)
+        {
+            if (patterns.size() == maxPatterns)
+            {
+                LOG("Too many process patterns, ignoring " + name, LogType::WARN);
+                break;
+            }
+
+            string pattern = name;
+            if (ignoreCase)
+            {
+                for (char &c : pattern)
+                {
+                    c = tolower((unsigned char)c);
+                }
+            }
+
+            // Empty patterns never match, but keep their index
+            if (!pattern.empty())
+            {
+                firstByte[(unsigned char)pattern[0]] |= 1ULL << patterns.size();
+            }
+            patterns.push_back(pattern);
+        }
+    }
+
+    ~ProcessScanner()
+    {
+        if (procFd != -1)
+        {
+            close(procFd);
+        }
+    }
+
+    ProcessScanner(const ProcessScanner &) = delete;
+    ProcessScanner &operator=(const ProcessScanner &) = delete;
+
+    /**
+     * @brief Collect all numeric entries of /proc
+     */
+    bool listPids()
+    {
+        if (procFd == -1)
+        {
+            procFd = open(procRoot.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (procFd == -1)
+            {
+                LOG("Failed to open " + procRoot + ": " + strerror(errno), LogType::ERROR);
+                return false;
+            }
+        }
+        else
+        {
+            lseek(procFd, 0, SEEK_SET);
+        }
+
+        pids.clear();
+
+        struct linux_dirent64
+        {
+            uint64_t d_ino;
+            int64_t d_off;
+            unsigned short d_reclen;
+            unsigned char d_type;
+            char d_name[];
+        };
+
+        alignas(linux_dirent64) char buf[32768];
+        long n;
+
+        while ((n = syscall(SYS_getdents64, procFd, buf, sizeof(buf))) > 0)
+        {
+            stats.procBytes.fetch_add(n, memory_order_relaxed);
+            for (long pos = 0; pos < n;)
+            {
+                auto *entry = (linux_dirent64 *)(buf + pos);
+                pos += entry->d_reclen;
+
+                const char *name = entry->d_name;
+                if (*name < '1' || *name > '9')
+                {
+                    continue;
+                }
+
+                int pid = 0;
+                while (*name >= '0' && *name <= '9')
+                {
+                    pid = pid * 10 + (*name++ - '0');
+                }
+
+                if (*name == '\0')
+                {
+                    pids.push_back(pid);
+                }
+            }
+        }
+
+        return n == 0;
+    }
+
+    /**
+     * @brief Match one cmdline against every pattern in a single pass
+     * @return Bitmask of matching patterns
+     */
+    uint64_t matchAll(const char *text, size_t length) const
+    {
+        uint64_t matched = 0;
+
+        for (size_t i = 0; i < length; i++)
+        {
+            uint64_t candidates = firstByte[(unsigned char)text[i]] & ~matched;
+            while (candidates)
+            {
+                size_t index = __builtin_ctzll(candidates);
+                candidates &= candidates - 1;
+
+                const string &pattern = patterns[index];
+                if (pattern.size() <= length - i && memcmp(text + i, pattern.data(), pattern.size()) == 0)
+                {
+                    matched |= 1ULL << index;
+                }
+            }
+        }
+
+        return matched;
+    }
+
+    void scanRange(size_t begin, size_t end, vector<ProcessMatch> &matches) const
+    {
+        char path[32];
+        char cmdline[cmdlineSize];
+
+        for (size_t i = begin; i < end; i++)
+        {
+            snprintf(path, sizeof(path), "%d/cmdline", pids[i]);
+
+            int fd = openat(procFd, path, O_RDONLY | O_CLOEXEC);
+            if (fd == -1)
+            {
+                continue; // exited in the meantime
+            }
+            ssize_t n = pread(fd, cmdline, sizeof(cmdline), 0);
+            close(fd);
+
+            // Kernel threads have no cmdline
+            if (n <= 0)
+            {
+                continue;
+            }
+            stats.procBytes.fetch_add(n, memory_order_relaxed);
+
+            for (ssize_t j = 0; j < n; j++)
+            {
+                if (cmdline[j] == '\0')
+                {
+                    cmdline[j] = ' ';
+                }
+                else if (ignoreCase)
+                {
+                    cmdline[j] = tolower((unsigned char)cmdline[j]);
+                }
+            }
+
+            uint64_t matched = matchAll(cmdline, n);
+            while (matched)
+            {
+                size_t index = __builtin_ctzll(matched);
+                matched &= matched - 1;
+                matches.push_back({pids[i], index});
+            }
+        }
+    }
+
+    /**
+     * @brief Walk /proc once
+     * @return Every (pid, pattern) pair that matched
+     */
+    vector<ProcessMatch> scan()
+    {
+        vector<ProcessMatch> matches;
+
+        long startNs = Timer::nowNs();
+        if (patterns.empty() || !listPids())
+        {
+            return matches;
+        }
+
+        size_t shards = min((size_t)max(thread::hardware_concurrency(), 1u), pids.size() / pidsPerShard);
+        if (shards <= 1)
+        {
+            scanRange(0, pids.size(), matches);
+            stats.processScan.record(Timer::nowNs() - startNs);
+            return matches;
+        }
+
+        mutex lock;
+        vector<thread> workers;
+        size_t perShard = (pids.size() + shards - 1) / shards;
+
+        for (size_t begin = 0; begin < pids.size(); begin += perShard)
+        {
+            size_t end = min(begin + perShard, pids.size());
+            workers.emplace_back([this, begin, end, &matches, &lock]()
+                                 {
+                                     vector<ProcessMatch> local;
+                                     scanRange(begin, end, local);
+
+                                     lock_guard<mutex> guard(lock);
+                                     matches.insert(matches.end(), local.begin(), local.end());
+                                 });
+        }
+
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+        stats.processScan.record(Timer::nowNs() - startNs);
+
+        LOG("Scanned " + to_string(pids.size()) + " processes in " + to_string(workers.size()) + " shards", LogType::DEBUG);
+        return matches;
+    }
+
+    /**
+     * @brief Convenience for callers that only care whether each pattern matched
+     */
+    vector<bool> scanFound()
+    {
+        vector<bool> found(patterns.size(), false);
+        for (const auto &match : scan())
+        {
+            found[match.pattern] = true;
+        }
+        return found;
+    }
+};
@@ -0,0 +1,370 @@
+#pragma once
+
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include <unordered_map>
+
+/**
+ * @brief Running processes whose executable is in the asset table.
+ * /proc is walked once, after that the table follows exec and exit events from the
+ * netlink process connector, so keeping it current costs one cmdline read per exec.
+ * Listening to the connector needs CAP_NET_ADMIN, which unprivileged users don't have.
+ * Without it rescan() has to be called periodically: it lists /proc and reads every stat to
+ * notice exec (the comm changes) and pid reuse (the start time changes), and only reads the
+ * cmdline of processes that are new or changed that way.
+ */
+struct ProcessTable
+{
+    struct Entry
+    {
+        string name;    // executable name, from argv[0]
+        uint64_t order; // start order, larger is newer
+    };
+
+    /**
+     * @brief What tells a process apart from the one that had its pid before, or from itself before an exec
+     */
+    struct Identity
+    {
+        unsigned long long start = 0; // starttime, in ticks since boot
+        string comm;
+
+        bool operator==(const Identity &other) const
+        {
+            return start == other.start && comm == other.comm;
+        }
+    };
+
+    // Asset key of an executable name as found in argv[0], false if it isn't in the table
+    function<bool(const string &, string &)> match;
+    // The set of matched processes changed
+    function<void()> onChange;
+
+    int fd = -1; // netlink socket, -1 when falling back to rescans
+    ProcessScanner lister{{}}; // only used to list /proc
+    unordered_map<int, Entry> running;
+    unordered_map<int, Identity> seen; // every process of the last rescan, only kept without netlink
+    uint64_t nextOrder = 0;
+    unsigned long events = 0;
+    unsigned long reads = 0;
+
+    ~ProcessTable()
+    {
+        close();
+    }
+
+    /**
+     * @brief Subscribe to process events if allowed, then take the initial snapshot.
+     * Subscribing first means nothing started during the walk is missed.
+     */
+    void init()
+    {
+        // Events carry pids of the real /proc, they mean nothing against a fixture
+        if (procRoot == "/proc" && !subscribe())
+        {
+            LOG("Process events unavailable (" + string(strerror(errno)) + "), rescanning /proc instead", LogType::DEBUG);
+        }
+
+        resync();
+    }
+
+    /**
+     * @brief Forget everything and take a new snapshot of /proc, e.g. after the asset table changed
+     */
+    void resync()
+    {
+        running.clear();
+        seen.clear();
+        rescan();
+        if (fd != -1)
+        {
+            // Only the rescans need to remember every pid
+            seen = unordered_map<int, Identity>();
+        }
+    }
+
+    bool usingEvents() const
+    {
+        return fd != -1;
+    }
+
+    bool subscribe()
+    {
+        fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        struct sockaddr_nl addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = CN_IDX_PROC;
+
+        // nlmsghdr, then cn_msg, then the operation as its payload
+        alignas(struct nlmsghdr) char request[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op))];
+        memset(request, 0, sizeof(request));
+
+        auto *header = (struct nlmsghdr *)request;
+        header->nlmsg_len = sizeof(request);
+        header->nlmsg_type = NLMSG_DONE;
+
+        auto *msg = (struct cn_msg *)NLMSG_DATA(header);
+        msg->id.idx = CN_IDX_PROC;
+        msg->id.val = CN_VAL_PROC;
+        msg->len = sizeof(enum proc_cn_mcast_op);
+        *(enum proc_cn_mcast_op *)msg->data = PROC_CN_MCAST_LISTEN;
+
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+            send(fd, &request, sizeof(request), 0) == -1)
+        {
+            int err = errno;
+            ::close(fd);
+            fd = -1;
+            errno = err;
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (fd != -1)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    /**
+     * @brief Apply every queued process event
+     */
+    void dispatch()
+    {
+        alignas(struct nlmsghdr) char buf[8192];
+        bool changed = false;
+        ssize_t n;
+
+        while ((n = recv(fd, buf, sizeof(buf), 0)) > 0)
+        {
+            int len = n;
+            for (auto *header = (struct nlmsghdr *)buf; NLMSG_OK(header, len); header = NLMSG_NEXT(header, len))
+            {
+                if (header->nlmsg_type == NLMSG_NOOP || header->nlmsg_type == NLMSG_ERROR)
+                {
+                    continue;
+                }
+
+                auto *msg = (struct cn_msg *)NLMSG_DATA(header);
+                if (msg->id.idx != CN_IDX_PROC || msg->id.val != CN_VAL_PROC)
+                {
+                    continue;
+                }
+
+                auto *ev = (struct proc_event *)msg->data;
+                events++;
+                if (ev->what == proc_event::PROC_EVENT_EXEC)
+                {
+                    // Whichever thread called exec, the process keeps its tgid
+                    changed = identify(ev->event_data.exec.process_tgid) || changed;
+                }
+                else if (ev->what == proc_event::PROC_EVENT_EXIT && ev->event_data.exit.process_pid == ev->event_data.exit.process_tgid)
+                {
+                    changed = running.erase(ev->event_data.exit.process_tgid) || changed;
+                }
+            }
+        }
+
+        if (n == -1 && errno == ENOBUFS)
+        {
+            // Events were dropped, anything may have happened since
+            LOG("Process events overflowed, rescanning /proc", LogType::DEBUG);
+            resync();
+            changed = true;
+        }
+
+        if (changed && onChange)
+        {
+            onChange();
+        }
+    }
+
+    /**
+     * @brief Reconcile with a listing of /proc, only reading the cmdline of processes that are
+     * new or whose identity changed since the last rescan
+     * @return true if the matched processes changed
+     */
+    bool rescan()
+    {
+        if (!lister.listPids())
+        {
+            return false;
+        }
+
+        bool changed = false;
+        unordered_map<int, Identity> current;
+        current.reserve(lister.pids.size());
+
+        for (int pid : lister.pids)
+        {
+            Identity identity;
+            if (!readIdentity(pid, identity))
+            {
+                continue; // exited since the listing
+            }
+
+            auto it = seen.find(pid);
+            if (it == seen.end() || !(it->second == identity))
+            {
+                changed = identify(pid) || changed;
+            }
+            current.emplace(pid, move(identity));
+        }
+
+        for (auto it = running.begin(); it != running.end();)
+        {
+            if (current.count(it->first))
+            {
+                it++;
+                continue;
+            }
+            it = running.erase(it);
+            changed = true;
+        }
+
+        seen.swap(current);
+        return changed;
+    }
+
+    /**
+     * @brief comm and starttime of a process, from its stat
+     */
+    bool readIdentity(int pid, Identity &identity)
+    {
+        char path[32];
+        char buf[1024];
+
+        snprintf(path, sizeof(path), "%d/stat", pid);
+        int file = openat(lister.procFd, path, O_RDONLY | O_CLOEXEC);
+        if (file == -1)
+        {
+            return false;
+        }
+        ssize_t n = ProcessTreeSampler::readFd(file, buf, sizeof(buf));
+        ::close(file);
+
+        const char *open = n < 0 ? nullptr : strchr(buf, '(');
+        const char *p = open ? ProcessTreeSampler::afterComm(buf) : nullptr;
+        if (!p || !*p)
+        {
+            return false;
+        }
+        identity.comm.assign(open + 1, strrchr(buf, ')') - open - 1);
+
+        // starttime is field 22, p is at the state, field 3
+        for (int field = 3; field < 22; field++)
+        {
+            p = skipSpaces(p);
+            while (*p && *p != ' ')
+            {
+                p++;
+            }
+        }
+        identity.start = scanNumber(p);
+        return true;
+    }
+
+    /**
+     * @brief Read what a process runs now and track it if it's in the asset table
+     * @return true if the matched processes changed
+     */
+    bool identify(int pid)
+    {
+        bool wasRunning = running.erase(pid);
+        string name = executableName(pid);
+        string asset;
+
+        if (name.empty() || !match || !match(name, asset))
+        {
+            return wasRunning;
+        }
+
+        running[pid] = {name, nextOrder++};
+        return true;
+    }
+
+    /**
+     * @brief Basename of argv[0], empty for kernel threads and processes that are gone
+     */
+    string executableName(int pid)
+    {
+        char path[32];
+        char cmdline[512];
+
+        snprintf(path, sizeof(path), "%d/cmdline", pid);
+        int file = openat(lister.procFd, path, O_RDONLY | O_CLOEXEC);
+        if (file == -1)
+        {
+            return "";
+        }
+        ssize_t n = pread(file, cmdline, sizeof(cmdline) - 1, 0);
+        ::close(file);
+
+        if (n <= 0)
+        {
+            return "";
+        }
+        reads++;
+        stats.procBytes.fetch_add(n, memory_order_relaxed);
+        cmdline[n] = '\0';
+
+        // Wine puts a Windows path in argv[0]
+        const char *name = cmdline;
+        for (const char *p = cmdline; *p; p++)
+        {
+            if (*p == '/' || *p == '\\')
+            {
+                name = p + 1;
+            }
+        }
+        return name;
+    }
+
+    /**
+     * @brief Names of the matched executables, oldest first, each listed once
+     */
+    vector<string> names() const
+    {
+        unordered_map<string, uint64_t> firstStart;
+        for (const auto &kv : running)
+        {
+            auto it = firstStart.find(kv.second.name);
+            if (it == firstStart.end() || kv.second.order < it->second)
+            {
+                firstStart[kv.second.name] = kv.second.order;
+            }
+        }
+
+        vector<pair<uint64_t, string>> ordered;
+        for (const auto &kv : firstStart)
+        {
+            ordered.emplace_back(kv.second, kv.first);
+        }
+        sort(ordered.begin(), ordered.end());
+
+        vector<string> out;
+        for (auto &item : ordered)
+        {
+            out.push_back(move(item.second));
+        }
+        return out;
+    }
+
+    string summary() const
+    {
+        return string("mode=") + (usingEvents() ? "events" : "rescan") +
+               " events=" + to_string(events) + " reads=" + to_string(reads) +
+               " running=" + to_string(running.size());
+    }
+};
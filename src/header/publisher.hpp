@@ -0,0 +1,220 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+// Same values as discord::ActivityType, so the payload doesn't depend on the Game SDK
+enum class ActivityType
+{
+    Playing = 0,
+    Streaming = 1,
+    Listening = 2,
+    Watching = 3
+};
+
+/**
+ * @brief Everything that ends up in a Discord activity.
+ * Kept as plain strings so two payloads can be compared before anything is sent.
+ */
+struct ActivityPayload
+{
+    string details;
+    string state;
+    string smallImage;
+    string smallText;
+    string largeImage;
+    string largeText;
+    long start = 0;
+    ActivityType type = ActivityType::Playing;
+
+    bool operator==(const ActivityPayload &o) const
+    {
+        return start == o.start && type == o.type &&
+               details == o.details && state == o.state &&
+               smallImage == o.smallImage && smallText == o.smallText &&
+               largeImage == o.largeImage && largeText == o.largeText;
+    }
+
+    bool operator!=(const ActivityPayload &o) const
+    {
+        return !(*this == o);
+    }
+};
+
+/**
+ * @brief Sits between the update loop and Discord.
+ * Identical payloads are dropped, and bursts are coalesced into the latest payload
+ * so we stay within Discord's presence rate limit instead of having updates rejected.
+ */
+struct ActivityPublisher
+{
+    typedef chrono::steady_clock::time_point TimePoint;
+
+    // Discord accepts 5 presence updates per 20 seconds
+    static constexpr double bucketCapacity = 5;
+    static constexpr double refillPerSecond = 5.0 / 20.0;
+
+    function<void(const ActivityPayload &)> sink;
+
+    ActivityPayload lastSent;
+    bool hasSent = false;
+    ActivityPayload pending;
+    bool hasPending = false;
+
+    double tokens = bucketCapacity;
+    TimePoint lastRefill;
+    bool started = false;
+
+    atomic<unsigned long> sent{0};
+    atomic<unsigned long> suppressed{0};
+    atomic<unsigned long> coalesced{0};
+    atomic<unsigned long> failed{0};
+
+    // Updates handed to Discord whose callback hasn't run yet
+    atomic<int> inFlight{0};
+
+    // Set from Discord's callback thread when an update was rejected, forces a resend
+    atomic<bool> resend{false};
+
+    /**
+     * @brief Queue a payload, sending it right away if the rate limit allows
+     * @return true if something was sent
+     */
+    bool submit(const ActivityPayload &payload, TimePoint now)
+    {
+        if (resend.exchange(false))
+        {
+            hasSent = false;
+        }
+
+        if (hasPending)
+        {
+            if (payload == pending)
+            {
+                suppressed++;
+                return flush(now);
+            }
+
+            if (hasSent && payload == lastSent)
+            {
+                // Changed back before the pending update went out, nothing to send anymore
+                hasPending = false;
+                suppressed++;
+                return false;
+            }
+
+            pending = payload;
+            coalesced++;
+            return flush(now);
+        }
+
+        if (hasSent && payload == lastSent)
+        {
+            suppressed++;
+            return false;
+        }
+
+        pending = payload;
+        hasPending = true;
+        return flush(now);
+    }
+
+    /**
+     * @brief Send the pending payload if there is one and a token is available
+     * @return true if something was sent
+     */
+    bool flush(TimePoint now)
+    {
+        refill(now);
+
+        if (!hasPending || tokens < 1)
+        {
+            return false;
+        }
+
+        tokens -= 1;
+        hasPending = false;
+        lastSent = pending;
+        hasSent = true;
+        sent++;
+
+        if (sink)
+        {
+            sink(lastSent);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Hand the latest activity to a sink that lost what it had, e.g. a new connection.
+     * Not rate limited, the new connection hasn't seen any update yet.
+     * @return true if there was anything to send
+     */
+    bool replay()
+    {
+        if (hasPending)
+        {
+            lastSent = pending;
+            hasSent = true;
+            hasPending = false;
+        }
+        else if (!hasSent)
+        {
+            return false;
+        }
+
+        sent++;
+        if (sink)
+        {
+            sink(lastSent);
+        }
+        return true;
+    }
+
+    /**
+     * @brief When the pending payload can go out, or the epoch if nothing is pending
+     */
+    TimePoint nextFlush(TimePoint now)
+    {
+        if (!hasPending)
+        {
+            return TimePoint();
+        }
+
+        refill(now);
+        if (tokens >= 1)
+        {
+            return now;
+        }
+
+        // Rounded up, so the token is there by then
+        return now + chrono::ceil<chrono::steady_clock::duration>(
+                         chrono::duration<double>((1 - tokens) / refillPerSecond));
+    }
+
+    void refill(TimePoint now)
+    {
+        if (!started)
+        {
+            lastRefill = now;
+            started = true;
+            return;
+        }
+
+        double elapsed = chrono::duration<double>(now - lastRefill).count();
+        if (elapsed <= 0)
+        {
+            return;
+        }
+
+        tokens = min(bucketCapacity, tokens + elapsed * refillPerSecond);
+        lastRefill = now;
+    }
+
+    string summary()
+    {
+        return "sent=" + to_string(sent) + " suppressed=" + to_string(suppressed) +
+               " coalesced=" + to_string(coalesced) + " failed=" + to_string(failed);
+    }
+};
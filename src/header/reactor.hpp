@@ -0,0 +1,284 @@
+#pragma once
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <signal.h>
+#include <unordered_map>
+#include <functional>
+
+/**
+ * @brief Timer backed by a timerfd on CLOCK_MONOTONIC.
+ * Periodic timers use absolute deadlines, so they don't drift no matter how long
+ * handlers take, and the lateness of every expiration is recorded.
+ */
+struct Timer
+{
+    int fd = -1;
+    long intervalNs = 0;
+    long deadlineNs = 0; // next expected expiration
+
+    unsigned long expirations = 0;
+    unsigned long missed = 0; // expirations that were coalesced because we woke up too late
+    long maxJitterNs = 0;
+    long totalJitterNs = 0;
+
+    static long nowNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000L + ts.tv_nsec;
+    }
+
+    static struct timespec toTimespec(long ns)
+    {
+        struct timespec ts;
+        ts.tv_sec = ns / 1000000000L;
+        ts.tv_nsec = ns % 1000000000L;
+        return ts;
+    }
+
+    Timer()
+    {
+        fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    }
+
+    ~Timer()
+    {
+        if (fd != -1)
+        {
+            close(fd);
+        }
+    }
+
+    Timer(const Timer &) = delete;
+    Timer &operator=(const Timer &) = delete;
+
+    /**
+     * @brief Fire every intervalMs, first expiration one interval from now
+     */
+    void start(long intervalMs)
+    {
+        intervalNs = intervalMs * 1000000L;
+        deadlineNs = nowNs() + intervalNs;
+
+        struct itimerspec spec;
+        spec.it_value = toTimespec(deadlineNs);
+        spec.it_interval = toTimespec(intervalNs);
+        timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    }
+
+    /**
+     * @brief Fire once at the given CLOCK_MONOTONIC time
+     */
+    void arm(long atNs)
+    {
+        intervalNs = 0;
+        deadlineNs = max(atNs, 1L);
+
+        struct itimerspec spec = {};
+        spec.it_value = toTimespec(deadlineNs);
+        timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    }
+
+    void disarm()
+    {
+        intervalNs = 0;
+        deadlineNs = 0;
+
+        struct itimerspec spec = {};
+        timerfd_settime(fd, 0, &spec, nullptr);
+    }
+
+    bool armed() const
+    {
+        return deadlineNs != 0;
+    }
+
+    /**
+     * @brief Consume the expiration and update jitter statistics
+     * @return false on spurious wakeups
+     */
+    bool acknowledge()
+    {
+        uint64_t count;
+        if (read(fd, &count, sizeof(count)) != sizeof(count))
+        {
+            return false;
+        }
+
+        long jitter = nowNs() - (deadlineNs + (long)(count - 1) * intervalNs);
+        maxJitterNs = max(maxJitterNs, jitter);
+        totalJitterNs += jitter;
+        expirations++;
+        missed += count - 1;
+
+        deadlineNs = intervalNs ? deadlineNs + (long)count * intervalNs : 0;
+        return true;
+    }
+
+    string jitterSummary() const
+    {
+        long avg = expirations ? totalJitterNs / (long)expirations : 0;
+        return "expirations=" + to_string(expirations) + " missed=" + to_string(missed) +
+               " avg_jitter_us=" + to_string(avg / 1000) + " max_jitter_us=" + to_string(maxJitterNs / 1000);
+    }
+};
+
+/**
+ * @brief Single-threaded epoll loop.
+ * Every source (X connection, IPC sockets, timers, signals) is a file descriptor
+ * with a handler, so the process only wakes up when one of them has something for us.
+ */
+struct Reactor
+{
+    int epfd = -1;
+    bool running = false;
+    unsigned long wakeups = 0;
+
+    unordered_map<int, function<void(uint32_t)>> handlers;
+
+    // Run before every wait, for sources that may buffer input outside of their fd (Xlib, XCB).
+    // They should only look at that buffer, a syscall here would cost one on every wakeup.
+    vector<function<void()>> prepareHooks;
+
+    Reactor()
+    {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+    }
+
+    ~Reactor()
+    {
+        if (epfd != -1)
+        {
+            close(epfd);
+        }
+    }
+
+    bool add(int fd, function<void(uint32_t)> handler, uint32_t events = EPOLLIN)
+    {
+        struct epoll_event ev = {};
+        ev.events = events;
+        ev.data.fd = fd;
+
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        {
+            LOG("Failed to watch fd " + to_string(fd) + ": " + strerror(errno), LogType::ERROR);
+            return false;
+        }
+
+        handlers[fd] = handler;
+        return true;
+    }
+
+    bool add(Timer &timer, function<void()> handler)
+    {
+        return add(timer.fd, [&timer, handler](uint32_t)
+                   {
+                       if (timer.acknowledge())
+                       {
+                           handler();
+                       }
+                   });
+    }
+
+    void modify(int fd, uint32_t events)
+    {
+        struct epoll_event ev = {};
+        ev.events = events;
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+    }
+
+    void remove(int fd)
+    {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+        handlers.erase(fd);
+    }
+
+    /**
+     * @brief Block the given signals in the calling thread and the threads it starts later.
+     * The kernel delivers a process signal to any thread that doesn't block it, so this has to
+     * run before the first thread is started for the signalfd to be the only receiver.
+     * @return The blocked set
+     */
+    static sigset_t blockSignals(initializer_list<int> signals)
+    {
+        sigset_t mask;
+        sigemptyset(&mask);
+        for (int sig : signals)
+        {
+            sigaddset(&mask, sig);
+        }
+        pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+        return mask;
+    }
+
+    /**
+     * @brief Route the given signals to a handler instead of their default action
+     * @return The signalfd, or -1 on error
+     */
+    int addSignals(initializer_list<int> signals, function<void(int)> handler)
+    {
+        sigset_t mask = blockSignals(signals);
+
+        int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (fd == -1)
+        {
+            return -1;
+        }
+
+        add(fd, [fd, handler](uint32_t)
+            {
+                struct signalfd_siginfo info;
+                while (read(fd, &info, sizeof(info)) == sizeof(info))
+                {
+                    handler(info.ssi_signo);
+                }
+            });
+        return fd;
+    }
+
+    void stop()
+    {
+        running = false;
+    }
+
+    void run()
+    {
+        struct epoll_event events[16];
+        running = true;
+
+        while (running)
+        {
+            for (auto &hook : prepareHooks)
+            {
+                hook();
+            }
+
+            int n = epoll_wait(epfd, events, 16, -1);
+            if (n == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                LOG(string("epoll_wait failed: ") + strerror(errno), LogType::ERROR);
+                break;
+            }
+
+            wakeups++;
+
+            for (int i = 0; i < n && running; i++)
+            {
+                auto it = handlers.find(events[i].data.fd);
+                if (it != handlers.end())
+                {
+                    // Copy, the handler may remove itself
+                    auto handler = it->second;
+                    handler(events[i].events);
+                }
+            }
+        }
+    }
+};
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <mutex>
+#include <sys/syscall.h>
+
+/**
+ * @brief Timeline of the startup phases, printed with --startup-trace.
+ * Phases may run on worker threads, they are told apart by thread ID in the output.
+ */
+struct StartupTrace
+{
+    struct Phase
+    {
+        string name;
+        long startNs;
+        long endNs;
+        long tid;
+    };
+
+    // Static initialisation is as close to exec as we get without asking the kernel
+    long originNs = Timer::nowNs();
+    long readyNs = 0; // first presence handed to Discord
+
+    mutex lock;
+    vector<Phase> phases;
+
+    void add(const string &name, long startNs, long endNs)
+    {
+        lock_guard<mutex> guard(lock);
+        phases.push_back({name, startNs, endNs, (long)syscall(SYS_gettid)});
+    }
+
+    /**
+     * @return true the first time, when the startup is over
+     */
+    bool ready()
+    {
+        if (readyNs)
+        {
+            return false;
+        }
+        readyNs = Timer::nowNs();
+        return true;
+    }
+
+    double readyMs() const
+    {
+        return readyNs ? (readyNs - originNs) / 1e6 : 0;
+    }
+
+    string timeline()
+    {
+        lock_guard<mutex> guard(lock);
+        string out = "Startup timeline (ms since start):\n";
+        char line[160];
+
+        for (const auto &phase : phases)
+        {
+            string thread = phase.tid == getpid() ? "main" : to_string(phase.tid);
+            snprintf(line, sizeof(line), "  %8.2f .. %8.2f  %7.2f  [%s] %s\n",
+                     (phase.startNs - originNs) / 1e6, (phase.endNs - originNs) / 1e6,
+                     (phase.endNs - phase.startNs) / 1e6, thread.c_str(), phase.name.c_str());
+            out += line;
+        }
+
+        snprintf(line, sizeof(line), "  first presence at %.2f ms\n", readyMs());
+        return out + line;
+    }
+};
+
+StartupTrace startupTrace;
+
+/**
+ * @brief Adds the enclosing scope to the startup timeline
+ */
+struct StartupPhase
+{
+    const char *name;
+    long startNs = Timer::nowNs();
+
+    explicit StartupPhase(const char *n) : name(n) {}
+
+    ~StartupPhase()
+    {
+        startupTrace.add(name, startNs, Timer::nowNs());
+    }
+};
+
+/**
+ * @brief Results of probes that only change when some files do, kept across runs.
+ * Every entry remembers the mtimes of its sources and is dropped as soon as one differs.
+ */
+struct ProbeCache
+{
+    string path;
+    unordered_map<string, pair<string, string>> entries; // key -> (mtimes, value)
+    bool dirty = false;
+
+    explicit ProbeCache(const string &p) : path(p)
+    {
+        ifstream file(path);
+        string line;
+        while (getline(file, line))
+        {
+            // key \t mtimes \t value
+            size_t first = line.find('\t');
+            size_t second = first == string::npos ? string::npos : line.find('\t', first + 1);
+            if (second != string::npos)
+            {
+                entries[line.substr(0, first)] = {line.substr(first + 1, second - first - 1), line.substr(second + 1)};
+            }
+        }
+    }
+
+    static string stamp(const vector<string> &sources)
+    {
+        string out;
+        for (const auto &source : sources)
+        {
+            out += to_string(fileMtime(source)) + ",";
+        }
+        return out;
+    }
+
+    /**
+     * @brief Cached value of the probe, running it if the sources changed since
+     */
+    string get(const string &key, const vector<string> &sources, const function<string()> &probe)
+    {
+        string current = stamp(sources);
+        auto it = entries.find(key);
+        if (it != entries.end() && it->second.first == current)
+        {
+            return it->second.second;
+        }
+
+        string value = probe();
+        // Values are single line, anything else isn't worth caching
+        if (value.find_first_of("\t\n") == string::npos)
+        {
+            entries[key] = {current, value};
+            dirty = true;
+        }
+        return value;
+    }
+
+    bool save()
+    {
+        if (!dirty || path.empty())
+        {
+            return true;
+        }
+
+        error_code ec;
+        fs::create_directories(fs::path(path).parent_path(), ec);
+
+        string tmp = path + ".tmp";
+        ofstream file(tmp, ios::trunc);
+        for (const auto &kv : entries)
+        {
+            file << kv.first << '\t' << kv.second.first << '\t' << kv.second.second << '\n';
+        }
+        file.close();
+
+        if (file.fail() || rename(tmp.c_str(), path.c_str()) != 0)
+        {
+            LOG("Failed to write probe cache " + path, LogType::WARN);
+            unlink(tmp.c_str());
+            return false;
+        }
+        dirty = false;
+        return true;
+    }
+};
+
+string probeCachePath()
+{
+    string dir = cacheDir();
+    return dir.empty() ? "" : dir + "/probes";
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/**
+ * @brief Latency histogram with power-of-two microsecond buckets.
+ * Recording is a few relaxed atomic adds, so it can sit on hot paths and be fed
+ * from the scanner threads; percentiles are only resolved when a report is built.
+ */
+struct LatencyHistogram
+{
+    // Bucket i holds values below 2^i us, the last one everything from ~17 minutes up
+    static constexpr int bucketCount = 31;
+
+    atomic<unsigned long> buckets[bucketCount] = {};
+    atomic<unsigned long> count{0};
+    atomic<unsigned long> totalNs{0};
+    atomic<long> maxNs{0};
+
+    void record(long ns)
+    {
+        ns = max(ns, 0L);
+        unsigned long us = ns / 1000;
+        int bucket = us ? min(64 - __builtin_clzl(us), bucketCount - 1) : 0;
+
+        buckets[bucket].fetch_add(1, memory_order_relaxed);
+        count.fetch_add(1, memory_order_relaxed);
+        totalNs.fetch_add(ns, memory_order_relaxed);
+
+        long seen = maxNs.load(memory_order_relaxed);
+        while (ns > seen && !maxNs.compare_exchange_weak(seen, ns, memory_order_relaxed))
+        {
+        }
+    }
+
+    /**
+     * @brief Upper bound of the bucket the given fraction of the values falls into
+     */
+    unsigned long percentileUs(double fraction) const
+    {
+        unsigned long total = count.load(memory_order_relaxed);
+        unsigned long rank = (unsigned long)(total * fraction);
+        unsigned long seen = 0;
+
+        for (int i = 0; i < bucketCount; i++)
+        {
+            seen += buckets[i].load(memory_order_relaxed);
+            if (seen > rank)
+            {
+                return 1UL << i;
+            }
+        }
+        return 1UL << (bucketCount - 1);
+    }
+
+    string summary() const
+    {
+        unsigned long n = count.load(memory_order_relaxed);
+        if (n == 0)
+        {
+            return "count=0";
+        }
+
+        return "count=" + to_string(n) +
+               " avg_us=" + to_string(totalNs.load(memory_order_relaxed) / n / 1000) +
+               " p50_us<" + to_string(percentileUs(0.5)) +
+               " p90_us<" + to_string(percentileUs(0.9)) +
+               " p99_us<" + to_string(percentileUs(0.99)) +
+               " max_us=" + to_string(maxNs.load(memory_order_relaxed) / 1000);
+    }
+};
+
+/**
+ * @brief Counters the daemon keeps about itself, queried with brpc --stats
+ */
+struct Stats
+{
+    long startedNs = Timer::nowNs();
+
+    LatencyHistogram sampleCpu;    // reading and parsing /proc/stat
+    LatencyHistogram sampleMem;    // reading and parsing /proc/meminfo
+    LatencyHistogram sampleApp;    // reading stat and statm of the focused application's processes
+    LatencyHistogram processScan;  // one pass over the process table
+    LatencyHistogram focusLatency; // focus change until the activity is handed to Discord
+    LatencyHistogram reconnect;    // Discord connection lost until it's ready again
+
+    atomic<unsigned long> xRoundTrips{0};
+    atomic<unsigned long> procBytes{0};
+
+    // Reactor wakeups as of the previous report, for the rate since then
+    unsigned long lastWakeups = 0;
+    long lastReportNs = startedNs;
+};
+
+Stats stats;
+
+/**
+ * @brief Where the stats socket lives, per user so several sessions don't collide
+ */
+string statsSocketPath()
+{
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime && *runtime)
+    {
+        return string(runtime) + "/brpc.sock";
+    }
+    return "/tmp/brpc-" + to_string(getuid()) + ".sock";
+}
+
+/**
+ * @brief Listens on the stats socket and writes a report to every client that connects.
+ * The report is small enough to fit the socket buffer, so clients are never waited on.
+ */
+struct StatsServer
+{
+    int fd = -1;
+    string path;
+
+    function<string()> report;
+
+    ~StatsServer()
+    {
+        close();
+    }
+
+    bool listen(const string &p)
+    {
+        path = p;
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+        // Left behind by an instance that didn't exit cleanly, the pid file already told us it's gone
+        unlink(path.c_str());
+
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || ::listen(fd, 4) == -1)
+        {
+            LOG("Failed to listen on " + path + ": " + strerror(errno), LogType::WARN);
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+
+        LOG("Stats available on " + path, LogType::DEBUG);
+        return true;
+    }
+
+    /**
+     * @brief Answer every pending connection
+     */
+    void dispatch()
+    {
+        int client;
+        while ((client = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+        {
+            string out = report ? report() : "";
+            (void)!send(client, out.data(), out.size(), MSG_NOSIGNAL);
+            ::close(client);
+        }
+    }
+
+    void close()
+    {
+        if (fd != -1)
+        {
+            ::close(fd);
+            fd = -1;
+            unlink(path.c_str());
+        }
+    }
+};
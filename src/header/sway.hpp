@@ -0,0 +1,261 @@
+#pragma once
+
+#define SWAY_IPC_MAGIC "i3-ipc"
+#define SWAY_IPC_HEADER_SIZE 14 // magic, then payload length and message type in native byte order
+
+enum SwayIpcType : uint32_t
+{
+    SWAY_IPC_SUBSCRIBE = 2,
+    SWAY_IPC_GET_TREE = 4,
+    SWAY_IPC_EVENT_WORKSPACE = 0x80000000,
+    SWAY_IPC_EVENT_WINDOW = 0x80000003
+};
+
+/**
+ * @brief Subscription to window events over the i3/sway IPC protocol.
+ * The tree is only fetched once to find the initial focus, after that sway pushes
+ * focus, title and close events for the windows. Workspace events cover switching to an
+ * empty workspace, which focuses no window and so sends no window event.
+ */
+struct SwayEvents : CompositorBackend
+{
+    string in; // received bytes that don't form a complete message yet
+    long long activeId = -1;
+
+    const char *name() const override
+    {
+        return "sway";
+    }
+
+    static string socketPath()
+    {
+        for (const char *var : {"SWAYSOCK", "I3SOCK"})
+        {
+            const char *value = getenv(var);
+            if (value && *value)
+            {
+                return value;
+            }
+        }
+        return "";
+    }
+
+    static string message(uint32_t type, const string &payload)
+    {
+        string out = SWAY_IPC_MAGIC;
+        uint32_t header[2] = {(uint32_t)payload.size(), type};
+        out.append((const char *)header, sizeof(header));
+        return out + payload;
+    }
+
+    /**
+     * @brief Send a request and wait for its reply, only while the socket is still blocking
+     */
+    bool request(uint32_t type, const string &payload, string &reply)
+    {
+        string out = message(type, payload);
+        if (send(fd, out.data(), out.size(), MSG_NOSIGNAL) != (ssize_t)out.size())
+        {
+            return false;
+        }
+
+        char header[SWAY_IPC_HEADER_SIZE];
+        if (!readExactly(fd, header, sizeof(header)) || memcmp(header, SWAY_IPC_MAGIC, 6) != 0)
+        {
+            return false;
+        }
+
+        uint32_t length;
+        memcpy(&length, header + 6, sizeof(length));
+        reply.resize(length);
+        return readExactly(fd, &reply[0], length);
+    }
+
+    bool subscribe() override
+    {
+        string path = socketPath();
+        fd = path.empty() ? -1 : connectUnixSocket(path, false);
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        // Don't let a stuck compositor hang us here
+        struct timeval timeout = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        // Events only start after SUBSCRIBE, so the tree reply can't be mixed up with them
+        string reply;
+        if (!request(SWAY_IPC_GET_TREE, "", reply))
+        {
+            return false;
+        }
+        applyTree(reply);
+
+        if (!request(SWAY_IPC_SUBSCRIBE, "[\"window\",\"workspace\"]", reply) || !jsonGetBool(reply, "success"))
+        {
+            return false;
+        }
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        in.clear();
+        return true;
+    }
+
+    bool dispatch() override
+    {
+        if (fd == -1 && !reconnect())
+        {
+            return false;
+        }
+
+        string previousClass = activeClass;
+        string previousTitle = activeTitle;
+
+        bool alive = receive(in);
+
+        size_t pos = 0;
+        while (in.size() - pos >= SWAY_IPC_HEADER_SIZE)
+        {
+            if (in.compare(pos, 6, SWAY_IPC_MAGIC) != 0)
+            {
+                LOG("Invalid message from sway, resubscribing", LogType::ERROR);
+                alive = false;
+                break;
+            }
+
+            uint32_t header[2];
+            memcpy(header, in.data() + pos + 6, sizeof(header));
+            if (in.size() - pos - SWAY_IPC_HEADER_SIZE < header[0])
+            {
+                break;
+            }
+
+            if (header[1] == SWAY_IPC_EVENT_WINDOW)
+            {
+                handleWindowEvent(in.substr(pos + SWAY_IPC_HEADER_SIZE, header[0]));
+            }
+            else if (header[1] == SWAY_IPC_EVENT_WORKSPACE)
+            {
+                handleWorkspaceEvent(in.substr(pos + SWAY_IPC_HEADER_SIZE, header[0]));
+            }
+            pos += SWAY_IPC_HEADER_SIZE + header[0];
+        }
+        in.erase(0, pos);
+
+        if (!alive)
+        {
+            in.clear();
+            reconnect();
+        }
+
+        return activeClass != previousClass || (watchTitle && activeTitle != previousTitle);
+    }
+
+    void handleWindowEvent(const string &payload)
+    {
+        string change;
+        long long id = -1;
+        jsonGetString(payload, "change", change);
+        jsonGetInt(payload, "id", id);
+
+        if (change == "focus")
+        {
+            setActive(payload);
+        }
+        else if (change == "title" && id == activeId)
+        {
+            jsonGetString(payload, "name", activeTitle);
+        }
+        else if (change == "close" && id == activeId)
+        {
+            activeId = -1;
+            activeClass = "";
+            activeTitle = "";
+            activePid = 0;
+        }
+    }
+
+    /**
+     * @brief A workspace that got the focus without any window on it leaves nothing focused.
+     * Otherwise a window focus event follows, which names the window.
+     */
+    void handleWorkspaceEvent(const string &payload)
+    {
+        string change;
+        size_t current = jsonFindKey(payload, "current");
+        if (!jsonGetString(payload, "change", change) || change != "focus" || current == string::npos)
+        {
+            return;
+        }
+
+        // The workspace's own lists come first, its windows' lists are nested in them
+        string workspace = payload.substr(current, jsonSkipValue(payload, current) - current);
+        int windows = 0;
+        auto count = [&windows](const string &)
+        { windows++; };
+        jsonForEach(workspace, "nodes", count);
+        if (windows == 0)
+        {
+            jsonForEach(workspace, "floating_nodes", count);
+        }
+
+        if (windows == 0)
+        {
+            setActive("{}");
+        }
+    }
+
+    /**
+     * @brief Take the focus from a container node, the first of each key in node must be its own
+     */
+    void setActive(const string &node)
+    {
+        long long pid = 0;
+        string type;
+        activeId = -1;
+
+        // An output or an empty workspace can have the focus too, that is no window
+        if (jsonGetString(node, "type", type) && type != "con" && type != "floating_con")
+        {
+            setActive("{}");
+            return;
+        }
+        jsonGetInt(node, "id", activeId);
+
+        // Native Wayland windows have an app_id, XWayland ones the X class
+        if (!jsonGetString(node, "app_id", activeClass) && !jsonGetString(node, "class", activeClass))
+        {
+            activeClass = "";
+        }
+        if (!jsonGetString(node, "name", activeTitle))
+        {
+            activeTitle = "";
+        }
+        activePid = jsonGetInt(node, "pid", pid) ? pid : 0;
+    }
+
+    /**
+     * @brief Find the focused node of a GET_TREE reply.
+     * Every node has a "focused" key after its "id" and before its children, so the focused
+     * node's own keys lie between its id and the next node's "focused".
+     */
+    void applyTree(const string &tree)
+    {
+        size_t pos = 0;
+        while ((pos = jsonFindKey(tree, "focused", pos)) != string::npos && tree.compare(pos, 4, "true") != 0)
+        {
+        }
+
+        if (pos == string::npos)
+        {
+            setActive("{}");
+            return;
+        }
+
+        size_t start = tree.rfind("\"id\"", pos);
+        size_t end = jsonFindKey(tree, "focused", pos);
+        start = start == string::npos ? pos : start;
+        setActive(tree.substr(start, end == string::npos ? string::npos : end - start));
+    }
+};
@@ -0,0 +1,331 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <sched.h>
+
+/*
+ * Input traces
+ *
+ * --record=FILE writes every raw input of the presence pipeline to FILE, --replay=FILE feeds
+ * them back through the same code on a virtual clock, without X or Discord.
+ *
+ * Format: the magic, followed by records of
+ *   u8 type | varint nanoseconds since the previous record | varint payload size | payload
+ * Numbers inside payloads are varints as well, strings are stored as they are.
+ */
+
+#define TRACE_MAGIC "BRPCTRC1"
+
+enum TraceType : uint8_t
+{
+    TRACE_META = 1,     // startTime, wm, distro
+    TRACE_SAMPLE = 2,   // /proc/stat cpu columns and meminfo values, optionally the focused app's usage
+    TRACE_FOCUS = 3,    // class of the newly focused window, whichever backend reported it
+    TRACE_HYPRLAND = 4, // raw Hyprland event line, only in older traces: the focus is in TRACE_FOCUS too
+    TRACE_TICK = 5,     // the presence was updated
+    TRACE_TITLE = 6,    // title of the focused window, when titles are shown
+    TRACE_CORES = 7,    // index, total and idle jiffies of every online core, with --per-core
+    TRACE_RUNNING = 8   // running apps of the asset table, oldest first and newline separated, with --running-apps
+};
+
+struct TraceRecord
+{
+    TraceType type;
+    uint64_t time; // nanoseconds since the start of the trace
+    string payload;
+};
+
+inline void putVarint(string &out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out += (char)(value | 0x80);
+        value >>= 7;
+    }
+    out += (char)value;
+}
+
+inline bool getVarint(const string &in, size_t &pos, uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < in.size(); shift += 7)
+    {
+        uint8_t byte = in[pos++];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void putString(string &out, const string &value)
+{
+    putVarint(out, value.size());
+    out += value;
+}
+
+inline bool getString(const string &in, size_t &pos, string &value)
+{
+    uint64_t size;
+    if (!getVarint(in, pos, size) || size > in.size() - pos)
+    {
+        return false;
+    }
+    value = in.substr(pos, size);
+    pos += size;
+    return true;
+}
+
+struct TraceWriter
+{
+    FILE *file = nullptr;
+    chrono::steady_clock::time_point start;
+    uint64_t lastTime = 0;
+    string record;
+
+    ~TraceWriter()
+    {
+        close();
+    }
+
+    bool open(const string &path)
+    {
+        file = fopen(path.c_str(), "wb");
+        if (!file)
+        {
+            return false;
+        }
+
+        fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), file);
+        start = chrono::steady_clock::now();
+        lastTime = 0;
+        return true;
+    }
+
+    void close()
+    {
+        if (file)
+        {
+            fclose(file);
+            file = nullptr;
+        }
+    }
+
+    bool enabled() const
+    {
+        return file != nullptr;
+    }
+
+    void write(TraceType type, const string &payload)
+    {
+        if (!file)
+        {
+            return;
+        }
+
+        uint64_t now = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+
+        record.clear();
+        record += (char)type;
+        putVarint(record, now - lastTime);
+        putString(record, payload);
+        fwrite(record.data(), 1, record.size(), file);
+
+        lastTime = now;
+    }
+
+    void meta(long startTime, const string &wm, const string &distro)
+    {
+        string payload;
+        putVarint(payload, startTime);
+        putString(payload, wm);
+        putString(payload, distro);
+        write(TRACE_META, payload);
+    }
+
+    void sample(const CpuTimes &times, const MemInfo &mem, const AppUsage &app)
+    {
+        string payload;
+        for (unsigned long long column : times.columns)
+        {
+            putVarint(payload, column);
+        }
+        putVarint(payload, mem.total);
+        putVarint(payload, mem.available);
+
+        // Appended, so traces without it still parse
+        if (app.valid())
+        {
+            putVarint(payload, (uint64_t)(app.cpu * 100));
+            putVarint(payload, app.rssKb);
+        }
+        write(TRACE_SAMPLE, payload);
+
+        // Samples are seconds apart, a good moment to make sure nothing gets lost
+        fflush(file);
+    }
+
+    void focus(const string &windowClass)
+    {
+        write(TRACE_FOCUS, windowClass);
+    }
+
+    void cores(const CoreSampler &sampler)
+    {
+        string payload;
+        for (size_t i = 0; i < sampler.capacity; i++)
+        {
+            if (sampler.online[i])
+            {
+                putVarint(payload, i);
+                putVarint(payload, sampler.total[i]);
+                putVarint(payload, sampler.idle[i]);
+            }
+        }
+        write(TRACE_CORES, payload);
+    }
+
+    void running(const vector<string> &names)
+    {
+        string payload;
+        for (const auto &name : names)
+        {
+            payload += name + "\n";
+        }
+        write(TRACE_RUNNING, payload);
+    }
+
+    void title(const string &windowTitle)
+    {
+        write(TRACE_TITLE, windowTitle);
+    }
+
+    void tick()
+    {
+        write(TRACE_TICK, "");
+    }
+};
+
+struct TraceReader
+{
+    string data;
+    size_t pos = 0;
+    uint64_t time = 0;
+
+    bool open(const string &path)
+    {
+        ifstream file(path, ios::binary);
+        if (!file.is_open())
+        {
+            return false;
+        }
+
+        data.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        pos = strlen(TRACE_MAGIC);
+        time = 0;
+        return data.compare(0, pos, TRACE_MAGIC) == 0;
+    }
+
+    /**
+     * @return false at the end of the trace or if it is truncated
+     */
+    bool next(TraceRecord &rec)
+    {
+        if (pos >= data.size())
+        {
+            return false;
+        }
+
+        rec.type = (TraceType)data[pos++];
+
+        uint64_t delta;
+        if (!getVarint(data, pos, delta) || !getString(data, pos, rec.payload))
+        {
+            return false;
+        }
+
+        time += delta;
+        rec.time = time;
+        return true;
+    }
+
+    static bool parseMeta(const string &payload, long &startTime, string &wm, string &distro)
+    {
+        size_t pos = 0;
+        uint64_t value;
+        if (!getVarint(payload, pos, value))
+        {
+            return false;
+        }
+        startTime = value;
+        return getString(payload, pos, wm) && getString(payload, pos, distro);
+    }
+
+    static void parseRunning(const string &payload, vector<string> &names)
+    {
+        names.clear();
+        size_t start = 0, end;
+        while ((end = payload.find('\n', start)) != string::npos)
+        {
+            names.push_back(payload.substr(start, end - start));
+            start = end + 1;
+        }
+    }
+
+    static bool parseCores(const string &payload, CoreSampler &sampler)
+    {
+        size_t pos = 0;
+        uint64_t core, total, idle;
+
+        sampler.begin();
+        while (pos < payload.size())
+        {
+            // The index sizes the sampler's buffers, a corrupt trace mustn't make them huge
+            if (!getVarint(payload, pos, core) || !getVarint(payload, pos, total) || !getVarint(payload, pos, idle) ||
+                core >= CPU_SETSIZE)
+            {
+                return false;
+            }
+            sampler.set(core, total, idle);
+        }
+        return true;
+    }
+
+    static bool parseSample(const string &payload, CpuTimes &times, MemInfo &mem, AppUsage &app)
+    {
+        size_t pos = 0;
+        uint64_t value;
+
+        for (unsigned long long &column : times.columns)
+        {
+            if (!getVarint(payload, pos, value))
+            {
+                return false;
+            }
+            column = value;
+        }
+
+        if (!getVarint(payload, pos, value))
+        {
+            return false;
+        }
+        mem.total = value;
+
+        if (!getVarint(payload, pos, value))
+        {
+            return false;
+        }
+        mem.available = value;
+
+        uint64_t rss;
+        if (getVarint(payload, pos, value) && getVarint(payload, pos, rss))
+        {
+            app.cpu = value / 100.0;
+            app.rssKb = rss;
+        }
+        return true;
+    }
+};
@@ -1,86 +1,158 @@
 #pragma once
 
+#include <xcb/xcb.h>
+
 /**
- * @brief Get X window property simplified.
- * Should be freed after usage.
- * 
- * @param disp Current display
- * @param win Current window
- * @param xa_prop_type Prop type, equal to the return prop type Atom, otherwise NULL will be returned
- * @param prop_name Name of the property that should be queried. Will be converted to a new Atom
- * @return 1 on success, 0 on error
+ * @brief Atoms the X backend uses, interned once at startup.
+ * All requests are sent before the first reply is read, so this costs a single round trip.
  */
-static int get_property(Display *disp, Window win,
-                          Atom xa_prop_type, string prop_name, char *ret, size_t ret_length)
+struct XcbAtoms
 {
-    Atom xa_prop_name;
-    Atom xa_ret_type;
-    int ret_format;
-    unsigned long ret_nitems;
-    unsigned long ret_bytes_after;
-    unsigned long tmp_size;
-    unsigned char *ret_prop;
-
-    xa_prop_name = XInternAtom(disp, prop_name.c_str(), False);
-
-    if (XGetWindowProperty(disp, win, xa_prop_name, 0, (~0L), False,
-                           xa_prop_type, &xa_ret_type, &ret_format,
-                           &ret_nitems, &ret_bytes_after, &ret_prop) != Success)
+    xcb_atom_t netActiveWindow = XCB_ATOM_NONE;
+    xcb_atom_t netSupportingWmCheck = XCB_ATOM_NONE;
+    xcb_atom_t winSupportingWmCheck = XCB_ATOM_NONE;
+    xcb_atom_t netWmName = XCB_ATOM_NONE;
+    xcb_atom_t netWmPid = XCB_ATOM_NONE;
+    xcb_atom_t utf8String = XCB_ATOM_NONE;
+
+    bool intern(xcb_connection_t *conn)
     {
-        return 0;
+        struct
+        {
+            const char *name;
+            xcb_atom_t *atom;
+        } wanted[] = {
+            {"_NET_ACTIVE_WINDOW", &netActiveWindow},
+            {"_NET_SUPPORTING_WM_CHECK", &netSupportingWmCheck},
+            {"_WIN_SUPPORTING_WM_CHECK", &winSupportingWmCheck},
+            {"_NET_WM_NAME", &netWmName},
+            {"_NET_WM_PID", &netWmPid},
+            {"UTF8_STRING", &utf8String},
+        };
+        constexpr size_t count = sizeof(wanted) / sizeof(wanted[0]);
+
+        xcb_intern_atom_cookie_t cookies[count];
+        for (size_t i = 0; i < count; i++)
+        {
+            cookies[i] = xcb_intern_atom(conn, 0, strlen(wanted[i].name), wanted[i].name);
+        }
+
+        stats.xRoundTrips.fetch_add(1, memory_order_relaxed);
+        bool ok = true;
+        for (size_t i = 0; i < count; i++)
+        {
+            xcb_intern_atom_reply_t *reply = xcb_intern_atom_reply(conn, cookies[i], nullptr);
+            if (!reply)
+            {
+                ok = false;
+                continue;
+            }
+            *wanted[i].atom = reply->atom;
+            free(reply);
+        }
+        return ok;
     }
+};
 
-    if (xa_ret_type != xa_prop_type)
+/**
+ * @brief Ask for the whole value of a property, without waiting for the reply.
+ * Several requests can be issued before collecting them, they share a round trip.
+ * @param type Expected type, XCB_GET_PROPERTY_TYPE_ANY to accept any
+ */
+inline xcb_get_property_cookie_t requestProperty(xcb_connection_t *conn, xcb_window_t win,
+                                                 xcb_atom_t prop, xcb_atom_t type = XCB_GET_PROPERTY_TYPE_ANY)
+{
+    // The length is in 32 bit units, asking for everything means there is no size limit
+    return xcb_get_property(conn, 0, win, prop, type, 0, UINT32_MAX / 4);
+}
+
+/**
+ * @brief Collect a property reply
+ * @param types Accepted types, the reply is rejected if its type isn't one of them
+ * @return false if the property doesn't exist or has another type
+ */
+bool propertyReply(xcb_connection_t *conn, xcb_get_property_cookie_t cookie,
+                   initializer_list<xcb_atom_t> types, string &value)
+{
+    xcb_get_property_reply_t *reply = xcb_get_property_reply(conn, cookie, nullptr);
+    if (!reply)
     {
-        log("Invalid return type received: " + to_string(xa_ret_type), LogType::WARN);
-        XFree(ret_prop);
+        return false;
+    }
 
-        return 0;
+    bool ok = find(types.begin(), types.end(), reply->type) != types.end();
+    if (ok)
+    {
+        value.assign((const char *)xcb_get_property_value(reply), xcb_get_property_value_length(reply));
+    }
+    else if (reply->type != XCB_ATOM_NONE)
+    {
+        LOG("Invalid return type received: " + to_string(reply->type), LogType::WARN);
     }
 
-    tmp_size = (ret_format / (16 / sizeof(long))) * ret_nitems;
-    tmp_size = ret_length < tmp_size ? ret_length : tmp_size;
+    free(reply);
+    return ok;
+}
+
+/**
+ * @brief Collect a reply holding a window ID
+ * @return XCB_WINDOW_NONE if there is none
+ */
+xcb_window_t windowReply(xcb_connection_t *conn, xcb_get_property_cookie_t cookie, xcb_atom_t type = XCB_ATOM_WINDOW)
+{
+    string value;
+    if (!propertyReply(conn, cookie, {type}, value) || value.size() < sizeof(xcb_window_t))
+    {
+        return XCB_WINDOW_NONE;
+    }
 
-    memcpy(ret, ret_prop, tmp_size - 1);
-    ret[tmp_size - 1] = '\0';
+    xcb_window_t win;
+    memcpy(&win, value.data(), sizeof(win));
+    return win;
+}
 
-    XFree(ret_prop);
-    return 1;
+xcb_window_t screenRoot(xcb_connection_t *conn)
+{
+    return xcb_setup_roots_iterator(xcb_get_setup(conn)).data->root;
 }
 
-string wm_info(Display *disp)
+/**
+ * @brief Name of the running window manager, from the window it advertises on the root window
+ */
+string wm_info(xcb_connection_t *conn, const XcbAtoms &atoms)
 {
-    Window sup_window[256];
-    char wm_name[256];
+    xcb_window_t root = screenRoot(conn);
+
+    // Both hints are asked for at once, only one round trip is spent even when falling back
+    auto netCheck = requestProperty(conn, root, atoms.netSupportingWmCheck, XCB_ATOM_WINDOW);
+    auto winCheck = requestProperty(conn, root, atoms.winSupportingWmCheck, XCB_ATOM_CARDINAL);
 
-    if (!get_property(disp, DefaultRootWindow(disp),
-                      XA_WINDOW, "_NET_SUPPORTING_WM_CHECK",
-                      (char *)sup_window, sizeof(sup_window)))
+    stats.xRoundTrips.fetch_add(1, memory_order_relaxed);
+    xcb_window_t supWindow = windowReply(conn, netCheck);
+    xcb_window_t winSupWindow = windowReply(conn, winCheck, XCB_ATOM_CARDINAL);
+    if (supWindow == XCB_WINDOW_NONE)
     {
-        if (!get_property(disp, DefaultRootWindow(disp),
-                          XA_CARDINAL, "_WIN_SUPPORTING_WM_CHECK",
-                          (char *)sup_window, sizeof(sup_window)))
-        {
-            cout << "could not get window manager\n";
-            return "";
-        }
+        supWindow = winSupWindow;
+    }
+
+    if (supWindow == XCB_WINDOW_NONE)
+    {
+        LOG("Could not get window manager", LogType::DEBUG);
+        return "";
     }
 
     /* WM_NAME */
-    if (!get_property(disp, *sup_window,
-                      XInternAtom(disp, "UTF8_STRING", False), "_NET_WM_NAME",
-                      wm_name, sizeof(wm_name)))
+    string wm_name_str;
+    stats.xRoundTrips.fetch_add(1, memory_order_relaxed);
+    if (!propertyReply(conn, requestProperty(conn, supWindow, atoms.netWmName),
+                       {atoms.utf8String, XCB_ATOM_STRING}, wm_name_str))
     {
-        if (!get_property(disp, *sup_window,
-                          XA_STRING, "_NET_WM_NAME",
-                          wm_name, sizeof(wm_name)))
-        {
-            cout << "could not get window manager name\n";
-            return "";
-        }
+        LOG("Could not get window manager name", LogType::DEBUG);
+        return "";
     }
 
-    string wm_name_str = wm_name;
+    // Some WMs include the terminating NUL
+    wm_name_str = wm_name_str.c_str();
 
     // Check for hyprland smiley
     size_t pos = wm_name_str.find(":D");
@@ -90,4 +162,4 @@ string wm_info(Display *disp)
     }
 
     return wm_name_str;
-}
\ No newline at end of file
+}
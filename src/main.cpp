@@ -1,86 +1,592 @@
 #include "header/brpcpp.hpp"
 #include "header/logging.hpp"
+#include "header/reactor.hpp"
+#include "header/trace.hpp"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <signal.h>
+#include <future>
 
 #define PID_FILE "/tmp/brpc.pid"
 
-void *updateRPC(void *ptr)
+// Only used when process events aren't available
+#define PROCESS_RESCAN_MS 5000
+
+// Discord's SDK has no fd to wait on, so its callbacks are only polled quickly while an update is in flight
+#define CALLBACKS_FAST_MS 16
+#define CALLBACKS_IDLE_MS 1000
+
+Reactor reactor;
+AssetWatcher assetWatcher;
+Timer sampleTimer;
+Timer publishTimer;
+Timer idlePollTimer;
+Timer processRescanTimer;
+StatsServer statsServer;
+int compositorFd = -1;
+unsigned long compositorConnection = 0; // the one compositorFd belongs to
+
+#ifndef BRPC_NATIVE_IPC
+DiscordState state{};
+Timer callbacksTimer;
+bool callbacksFast = false;
+#endif
+DiscordIpcClient ipc;
+DiscordConnection connection;
+
+string lastWindow;
+string lastTitle;
+string titleText; // lastTitle with the redaction rules and length limit applied
+
+ProcessTreeSampler appSampler;
+AppUsage appUsage; // of the focused application, invalid until its tree was sampled twice
+ProcessTable processTable;
+vector<string> runningApps; // of processTable, oldest first
+WindowAsset windowAsset;
+DistroAsset distroAsset;
+
+TraceWriter recorder;
+
+// When the focus changed, until the resulting activity went out
+long focusChangedNs = 0;
+
+/**
+ * @brief Record how long a focus change took to reach Discord, if the sent activity carries one
+ */
+void activitySent()
 {
-    string windowName, lastWindow;
-    WindowAsset windowAsset;
-    DistroAsset distroAsset;
-    DiscordState *state = (struct DiscordState *)ptr;
+    if (startupTrace.ready())
+    {
+        LOG("First presence after " + to_string((long)startupTrace.readyMs()) + " ms", LogType::DEBUG);
+        if (config.startupTrace)
+        {
+            std::cerr << startupTrace.timeline();
+        }
+    }
 
-    log("Waiting for usages to load...", LogType::DEBUG);
+    if (focusChangedNs)
+    {
+        stats.focusLatency.record(Timer::nowNs() - focusChangedNs);
+        focusChangedNs = 0;
+    }
+}
 
-    // Wait for usages to load
-    while (cpu == -1 || mem == -1)
+/**
+ * @brief Whether a running process with this image is worth mentioning
+ */
+bool wantRunningApp(const string &image)
+{
+    auto listed = [&image](const vector<string> &images)
+    { return find(images.begin(), images.end(), image) != images.end(); };
+
+    if (!config.runningAppImages.empty())
     {
-        usleep(1000);
+        return listed(config.runningAppImages);
     }
+    return !listed(ambientApps);
+}
 
-    log("Starting RPC loop.", LogType::DEBUG);
-    distroAsset = getDistroAsset(distro);
+/**
+ * @brief Newest running app that isn't the focused one
+ * @return Empty if there is none
+ */
+string runningAppText()
+{
+    for (auto it = runningApps.rbegin(); it != runningApps.rend(); it++)
+    {
+        if (getWindowAsset(*it).image != windowAsset.image)
+        {
+            return *it;
+        }
+    }
+    return "";
+}
 
-    while (true)
+/**
+ * @brief Build the activity from the current state and hand it to the publisher
+ * @param now Time of the update, virtual when replaying a trace
+ */
+void publishPresence(const string &windowName, const string &windowTitle, chrono::steady_clock::time_point now)
+{
+    MetricsSnapshot sample;
+    metrics.read(sample);
+    if (!sample.valid())
+    {
+        return;
+    }
+
+    if (windowName != lastWindow)
     {
-        string cpupercent = to_string((long)cpu);
-        string rampercent = to_string((long)mem);
+        windowAsset = getWindowAsset(windowName);
+        lastWindow = windowName;
+    }
 
-        usleep(config.updateSleep * 1000);
+    if (windowTitle != lastTitle)
+    {
+        titleText = formatTitle(windowTitle);
+        lastTitle = windowTitle;
+    }
 
-        if (!config.noSmallImage)
+    ActivityPayload payload;
+    if (idleBackend && idleBackend->idle && config.idleAway)
+    {
+        payload.details = "Away";
+    }
+    else
+    {
+        payload.details = "CPU: " + to_string((long)sample.cpu) + "%";
+        if (config.perCore && coreSampler.valid())
+        {
+            payload.details += " (hottest " + to_string((long)coreSampler.hottestPercent) + "%)";
+        }
+        payload.details += " | RAM: " + to_string((long)sample.mem) + "%";
+    }
+    payload.state = "WM: " + wm;
+    if (config.runningApps)
+    {
+        string running = runningAppText();
+        if (!running.empty())
         {
-            try
+            payload.state += " | Running: " + running;
+        }
+    }
+    payload.smallImage = windowAsset.image;
+    payload.smallText = config.showTitle && !titleText.empty() ? titleText : windowAsset.text;
+    if (config.appUsage && appUsage.valid())
+    {
+        payload.smallText += " (" + appUsage.text() + ")";
+    }
+    payload.largeImage = distroAsset.image;
+    payload.largeText = distroAsset.text;
+    payload.start = startTime;
+    payload.type = ActivityType::Playing;
+
+    if (publisher.submit(payload, now))
+    {
+        activitySent();
+        LOG("Activity published (" + publisher.summary() + ")", LogType::DEBUG);
+    }
+    else if (!publisher.hasPending)
+    {
+        // Nothing to send for this change
+        focusChangedNs = 0;
+    }
+}
+
+/**
+ * @brief Wake up when the rate limit lets a coalesced update out, instead of polling for it
+ */
+void armFlush()
+{
+    auto now = chrono::steady_clock::now();
+    auto at = publisher.nextFlush(now);
+
+    if (at == chrono::steady_clock::time_point())
+    {
+        publishTimer.disarm();
+        return;
+    }
+
+    publishTimer.arm(Timer::nowNs() + chrono::duration_cast<chrono::nanoseconds>(at - now).count());
+}
+
+void updateRPC()
+{
+    string windowName = lastWindow;
+    string windowTitle = lastTitle;
+
+    if (!config.noSmallImage)
+    {
+        try
+        {
+            windowName = getActiveWindowClassName();
+        }
+        catch (exception ex)
+        {
+            LOG(ex.what(), LogType::ERROR);
+            return;
+        }
+
+        if (recorder.enabled() && windowName != lastWindow)
+        {
+            recorder.focus(windowName);
+        }
+
+        if (config.appUsage && getActiveWindowPid() != appSampler.rootPid)
+        {
+            // The numbers of the previous application mustn't show up next to this one
+            appSampler.setRoot(getActiveWindowPid());
+            appUsage = AppUsage();
+        }
+
+        if (config.showTitle)
+        {
+            windowTitle = getActiveWindowTitle();
+            if (recorder.enabled() && windowTitle != lastTitle)
             {
-                windowName = getActiveWindowClassName(disp);
+                recorder.title(windowTitle);
             }
-            catch (exception ex)
+        }
+    }
+
+    if (recorder.enabled())
+    {
+        recorder.tick();
+    }
+
+    publishPresence(windowName, windowTitle, chrono::steady_clock::now());
+    armFlush();
+}
+
+void applyUsage(const CpuTimes &times, const MemInfo &meminfo, const AppUsage &app)
+{
+    appUsage = app;
+
+    MetricsSnapshot sample;
+    sample.mem = meminfo.percent();
+    sample.cpu = cpuSampler.sample(times);
+    sample.sampledAtNs = Timer::nowNs();
+    metrics.publish(sample);
+}
+
+void updateUsage()
+{
+    CpuTimes times;
+    MemInfo meminfo;
+
+    long startNs = Timer::nowNs();
+    if (config.perCore)
+    {
+        // One read of /proc/stat serves both, generating it is what costs on large machines
+        const char *buf = coreSampler.read();
+        if (buf)
+        {
+            CpuSampler::parse(buf, times);
+            if (recorder.enabled())
             {
-                log(ex.what(), LogType::ERROR);
-                continue;
+                recorder.cores(coreSampler);
             }
+            coreSampler.compute();
+        }
+    }
+    else
+    {
+        CpuSampler::read(times);
+    }
+    long cpuReadNs = Timer::nowNs();
+    readMemInfo(meminfo);
+    long memReadNs = Timer::nowNs();
+    stats.sampleCpu.record(cpuReadNs - startNs);
+    stats.sampleMem.record(memReadNs - cpuReadNs);
+
+    AppUsage app;
+    if (config.appUsage)
+    {
+        app = appSampler.sample(memReadNs);
+        stats.sampleApp.record(Timer::nowNs() - memReadNs);
+    }
+
+    if (recorder.enabled())
+    {
+        recorder.sample(times, meminfo, app);
+    }
+
+    applyUsage(times, meminfo, app);
+}
+
+/**
+ * @brief Feed a recorded trace through the presence pipeline as fast as possible.
+ * Activities are printed instead of sent to Discord (or dropped with --replay-null).
+ */
+int replayTrace(const string &path)
+{
+    TraceReader reader;
+    if (!reader.open(path))
+    {
+        std::cerr << "Failed to read trace " << path << std::endl;
+        return 1;
+    }
+
+    buildMatchers();
+
+    TraceRecord rec;
+    string windowName;
+    string windowTitle;
+    unsigned long records = 0;
+    uint64_t lastTime = 0;
+    chrono::steady_clock::time_point epoch;
+
+    if (!config.replayNull)
+    {
+        publisher.sink = [&lastTime](const ActivityPayload &payload)
+        {
+            printf("[%10.3f] %s | %s | small=%s (%s) | large=%s (%s)\n", lastTime / 1e9,
+                   payload.details.c_str(), payload.state.c_str(),
+                   payload.smallImage.c_str(), payload.smallText.c_str(),
+                   payload.largeImage.c_str(), payload.largeText.c_str());
+        };
+    }
+
+    // What publishTimer does live: let a coalesced update out once the rate limit allows it
+    auto flushBefore = [&lastTime, epoch](chrono::steady_clock::time_point until)
+    {
+        while (publisher.hasPending)
+        {
+            auto at = publisher.nextFlush(epoch + chrono::nanoseconds(lastTime));
+            if (at > until)
+            {
+                return;
+            }
+            lastTime = chrono::duration_cast<chrono::nanoseconds>(at - epoch).count();
+            publisher.flush(at);
+        }
+    };
+
+    auto wallStart = chrono::steady_clock::now();
+
+    while (reader.next(rec))
+    {
+        flushBefore(epoch + chrono::nanoseconds(rec.time));
+        records++;
+        lastTime = rec.time;
 
-            if (windowName != lastWindow)
+        switch (rec.type)
+        {
+        case TRACE_META:
+        {
+            long start;
+            if (TraceReader::parseMeta(rec.payload, start, wm, distro))
             {
-                windowAsset = getWindowAsset(windowName);
-                lastWindow = windowName;
+                startTime = start;
+                distroAsset = getDistroAsset(distro);
             }
+            break;
         }
+        case TRACE_SAMPLE:
+        {
+            CpuTimes times;
+            MemInfo meminfo;
+            AppUsage app;
+            if (TraceReader::parseSample(rec.payload, times, meminfo, app))
+            {
+                applyUsage(times, meminfo, app);
+            }
+            break;
+        }
+        case TRACE_FOCUS:
+            windowName = rec.payload;
+            appUsage = AppUsage();
+            break;
+        case TRACE_CORES:
+            if (TraceReader::parseCores(rec.payload, coreSampler))
+            {
+                coreSampler.compute();
+            }
+            break;
+        case TRACE_RUNNING:
+            TraceReader::parseRunning(rec.payload, runningApps);
+            break;
+        case TRACE_TITLE:
+            windowTitle = rec.payload;
+            break;
+        case TRACE_HYPRLAND:
+            // Older traces recorded both, TRACE_FOCUS and TRACE_TITLE alone drive the replay
+            break;
+        case TRACE_TICK:
+            publishPresence(windowName, windowTitle, epoch + chrono::nanoseconds(rec.time));
+            break;
+        default:
+            LOG("Unknown trace record type " + to_string(rec.type), LogType::WARN);
+        }
+    }
 
-        setActivity(
-            *state,
-            string("CPU: " + cpupercent + "% | RAM: " + rampercent + "%"),
-            "WM: " + wm,
-            windowAsset.image,
-            windowAsset.text,
-            distroAsset.image,
-            distroAsset.text,
-            startTime,
-            discord::ActivityType::Playing
-        );
+    // The live daemon would still send what was pending when the trace ended
+    uint64_t inputTime = lastTime;
+    flushBefore(chrono::steady_clock::time_point::max());
+
+    double wall = chrono::duration<double>(chrono::steady_clock::now() - wallStart).count();
+    fprintf(stderr, "Replayed %lu records (%.1fs of input) in %.3fs, activities %s\n",
+            records, inputTime / 1e9, wall, publisher.summary().c_str());
+    return 0;
+}
+
+/**
+ * @brief Keep the reactor watching the current compositor socket, it changes on reconnects.
+ * Closing the old socket dropped it from epoll, and the new one is likely to get the same
+ * number, so the connection count tells them apart.
+ */
+void watchCompositor()
+{
+    if (compositor->fd == compositorFd && compositor->connections == compositorConnection)
+    {
+        return;
+    }
+
+    if (compositorFd != -1)
+    {
+        reactor.remove(compositorFd);
+    }
+
+    compositorFd = compositor->fd;
+    compositorConnection = compositor->connections;
+    if (compositorFd != -1)
+    {
+        reactor.add(compositorFd, [](uint32_t)
+                    {
+                        if (compositor->dispatch())
+                        {
+                            focusChangedNs = Timer::nowNs();
+                            updateRPC();
+                        }
+                        watchCompositor();
+                    });
     }
 }
 
-void *updateUsage(void *ptr)
+/**
+ * @brief Take the running apps over from the process table
+ * @return true if they changed
+ */
+bool refreshRunningApps()
 {
-    distro = getDistro();
-    log("Distro: " + distro, LogType::DEBUG);
+    vector<string> names = processTable.names();
+    if (names == runningApps)
+    {
+        return false;
+    }
 
-    startTime = time(0) - ms_uptime();
-    wm = string(wm_info(disp));
-    log("WM: " + wm, LogType::DEBUG);
+    runningApps = move(names);
+    if (recorder.enabled())
+    {
+        recorder.running(runningApps);
+    }
+    return true;
+}
 
-    while (true)
+void onRunningChange()
+{
+    if (refreshRunningApps())
+    {
+        updateRPC();
+    }
+}
+
+void reloadAssets()
+{
+    if (!assetWatcher.changed())
+    {
+        return;
+    }
+
+    LOG("Asset database changed, reloading", LogType::INFO);
+    buildMatchers();
+    distroAsset = getDistroAsset(distro);
+    windowAsset = getWindowAsset(lastWindow);
+    if (config.runningApps)
     {
-        mem = getRAM();
-        cpu = getCPU();
-        sleep(config.usageSleep / 1000.0);
+        processTable.resync();
+        refreshRunningApps();
     }
+    updateRPC();
+}
+
+void onXEvents(bool queuedOnly = false)
+{
+    if (focusWatcher.dispatch(queuedOnly) && !config.noSmallImage)
+    {
+        focusChangedNs = Timer::nowNs();
+        updateRPC();
+    }
+}
+
+/**
+ * @brief Slow down (or stop) sampling while the user is away, catch up right away when they're back
+ */
+void onIdleChange(bool idle)
+{
+    if (!idle)
+    {
+        sampleTimer.start(config.usageSleep);
+        updateUsage();
+        return;
+    }
+
+    if (config.idleSleep > 0)
+    {
+        sampleTimer.start(config.idleSleep);
+    }
+    else
+    {
+        sampleTimer.disarm();
+    }
+
+    if (config.idleAway)
+    {
+        updateRPC();
+    }
+}
+
+/**
+ * @brief Everything brpc --stats prints
+ */
+string statsReport()
+{
+    long now = Timer::nowNs();
+    double uptime = (now - stats.startedNs) / 1e9;
+    double sinceLast = (now - stats.lastReportNs) / 1e9;
+
+    char rates[128];
+    snprintf(rates, sizeof(rates), "avg_per_s=%.2f recent_per_s=%.2f",
+             uptime > 0 ? reactor.wakeups / uptime : 0,
+             sinceLast > 0 ? (reactor.wakeups - stats.lastWakeups) / sinceLast : 0);
+    stats.lastWakeups = reactor.wakeups;
+    stats.lastReportNs = now;
+
+    return "uptime_s: " + to_string((long)uptime) + "\n" +
+           "startup_ms: " + to_string((long)startupTrace.readyMs()) + "\n" +
+           "wakeups: total=" + to_string(reactor.wakeups) + " " + rates + "\n" +
+           "sample_cpu: " + stats.sampleCpu.summary() + "\n" +
+           "sample_mem: " + stats.sampleMem.summary() + "\n" +
+           "sample_app: " + stats.sampleApp.summary() + " processes=" + (appSampler.usingCgroup() ? string("cgroup") : to_string(appSampler.tracked.size())) + "\n" +
+           (config.perCore ? "cores: " + coreSampler.summary() + "\n" : "") +
+           (config.runningApps ? "process_table: " + processTable.summary() + "\n" : "") +
+           "process_scan: " + stats.processScan.summary() + "\n" +
+           "focus_source: " + (compositor ? compositor->name() : "x11") + "\n" +
+           "focus_to_update: " + stats.focusLatency.summary() + "\n" +
+           "discord: " + connection.summary() + "\n" +
+           "reconnect: " + stats.reconnect.summary() + "\n" +
+           "activities: " + publisher.summary() + " in_flight=" + to_string(publisher.inFlight) + "\n" +
+           "x_round_trips: " + to_string(stats.xRoundTrips.load(memory_order_relaxed)) + "\n" +
+           "proc_bytes_read: " + to_string(stats.procBytes.load(memory_order_relaxed)) + "\n" +
+           "sample_timer: " + sampleTimer.jitterSummary() + "\n" +
+           "publish_timer: " + publishTimer.jitterSummary() + "\n" +
+           "idle_source: " + (idleBackend ? idleBackend->name() : "none") + "\n" +
+           "idle: " + to_string(idleBackend && idleBackend->idle) + "\n";
+}
+
+/**
+ * @brief Print the stats of the running instance
+ */
+int queryStats()
+{
+    string path = statsSocketPath();
+    int sock = connectUnixSocket(path, false);
+    if (sock == -1)
+    {
+        std::cerr << "No running brpc process found at " << path << "." << std::endl;
+        return 1;
+    }
+
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(sock, buf, sizeof(buf))) > 0)
+    {
+        std::cout.write(buf, n);
+    }
+    close(sock);
+    return 0;
 }
 
 void writePidFile()
@@ -192,10 +698,230 @@ void daemonize()
     close(devNull);
 }
 
+/**
+ * @brief Use the built-in IPC client, everything is driven by its socket so there is nothing to poll
+ */
+void setupNativeIpc()
+{
+    ipc.onResult = [](bool ok, const string &message)
+    {
+        publisher.inFlight--;
+        if (ok)
+        {
+            LOG("Succeeded updating activity!", LogType::DEBUG);
+            return;
+        }
+        publisher.failed++;
+        publisher.resend = true;
+        LOG("Failed updating activity! (" + message + ")", LogType::WARN);
+    };
+
+    ipc.onWantWrite = [](bool wantWrite)
+    { reactor.modify(ipc.fd, wantWrite ? EPOLLIN | EPOLLOUT : EPOLLIN); };
+    ipc.onReady = []()
+    { connection.ready(); };
+    ipc.onLost = [](const string &message)
+    { connection.lost(message); };
+
+    publisher.sink = [](const ActivityPayload &payload)
+    {
+        // Replayed once the connection is ready
+        if (!connection.isReady())
+        {
+            return;
+        }
+        publisher.inFlight++;
+        ipc.setActivity(payload);
+    };
+
+    connection.open = []()
+    {
+        if (!ipc.connect())
+        {
+            LOG("Failed to connect to Discord's IPC socket!", LogType::WARN);
+            return false;
+        }
+        // The handshake is still queued, it goes out on the first EPOLLOUT
+        uint32_t interest = ipc.wantsWrite() ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        return reactor.add(ipc.fd, [](uint32_t events)
+                           { ipc.dispatch(events); }, interest);
+    };
+
+    connection.close = []()
+    {
+        if (ipc.fd != -1)
+        {
+            reactor.remove(ipc.fd);
+        }
+        ipc.disconnect();
+        // Their results will never come
+        publisher.inFlight = 0;
+    };
+}
+
+#ifndef BRPC_NATIVE_IPC
+void setupGameSdk()
+{
+    connection.open = []()
+    {
+        discord::Core *core{};
+        // The default flag would exit the process when Discord goes away
+        auto result = discord::Core::Create(934099338374824007, DiscordCreateFlags_NoRequireDiscord, &core); // Change with your own app's ID if you made one
+        state.core.reset(core);
+        state.broken = false;
+
+        if (!state.core)
+        {
+            LOG("Failed to instantiate discord core! (err " + to_string(static_cast<int>(result)) + ")", LogType::WARN);
+            return false;
+        }
+
+        if (config.debug)
+        {
+            state.core->SetLogHook(
+                discord::LogLevel::Debug,
+                [](discord::LogLevel level, const char *message)
+                {
+                    std::cerr << "Log(" << static_cast<uint32_t>(level) << "): " << message << "\n";
+                }
+            );
+        }
+
+        // The SDK does its own handshake and queues what is sent before it's done
+        connection.ready();
+        return true;
+    };
+
+    connection.close = []()
+    {
+        state.core.reset();
+        publisher.inFlight = 0;
+    };
+
+    publisher.sink = [](const ActivityPayload &payload)
+    {
+        // Replayed once the connection is ready
+        if (!connection.isReady())
+        {
+            return;
+        }
+
+        setActivity(state, payload);
+        if (!callbacksFast)
+        {
+            callbacksFast = true;
+            callbacksTimer.start(CALLBACKS_FAST_MS);
+        }
+    };
+
+    reactor.add(callbacksTimer, []()
+                {
+                    if (!state.core)
+                    {
+                        return;
+                    }
+
+                    auto result = state.core->RunCallbacks();
+                    if (result != discord::Result::Ok || state.broken)
+                    {
+                        connection.lost("Game SDK error " + to_string(static_cast<int>(result)));
+                        return;
+                    }
+
+                    if (callbacksFast && publisher.inFlight == 0)
+                    {
+                        callbacksFast = false;
+                        callbacksTimer.start(CALLBACKS_IDLE_MS);
+                    }
+                });
+    callbacksTimer.start(CALLBACKS_IDLE_MS);
+}
+#else
+void setupGameSdk()
+{
+    setupNativeIpc();
+}
+#endif
+
+/**
+ * @brief A new connection knows nothing about us, give it the current activity right away
+ */
+void onDiscordReady()
+{
+    if (publisher.replay())
+    {
+        LOG("Replayed the last activity", LogType::DEBUG);
+    }
+}
+
+// How often the /proc scan runs as a fallback while waiting for Discord
+#define DISCORD_SCAN_FALLBACK_MS 30000
+#define DISCORD_SCAN_FALLBACK_NO_INOTIFY_MS 5000
+
+/**
+ * @brief Block until Discord or Vesktop is up.
+ * New IPC sockets are picked up through inotify, the /proc scan only runs as a fallback
+ * for clients that put their socket somewhere we don't watch.
+ */
+void waitForDiscord()
+{
+    if (!findDiscordIpcSocket().empty())
+    {
+        return;
+    }
+
+    DiscordReadinessWatcher watcher;
+    bool watching = watcher.init();
+    int scanInterval = watching ? DISCORD_SCAN_FALLBACK_MS : DISCORD_SCAN_FALLBACK_NO_INOTIFY_MS;
+
+    ProcessScanner discordScanner({"discord", "vesktop"});
+    int waitedTime = 0;
+
+    while (true)
+    {
+        vector<bool> found = discordScanner.scanFound();
+        LOG(
+            "Checking processes: discord=" + std::to_string(found[0]) +
+            ", vesktop=" + std::to_string(found[1]) +
+            ", ignoreDiscord=" + std::to_string(config.ignoreDiscord),
+            LogType::DEBUG
+        );
+
+        if (found[0] || found[1])
+        {
+            return;
+        }
+
+        if (waitedTime > 20000)
+        {
+            LOG(
+                std::string("Neither Discord nor Vesktop is running. Maybe ignore Discord check with --ignore-discord or -f?"),
+                LogType::INFO
+            );
+        }
+
+        LOG("Waiting for Discord or Vesktop...", LogType::INFO);
+        waitedTime += scanInterval;
+
+        if (!watching)
+        {
+            usleep(scanInterval * 1000);
+        }
+        else if (watcher.wait(scanInterval))
+        {
+            return;
+        }
+    }
+}
+
 int main(int argc, char **argv)
 {
-    parseConfigs();
-    parseArgs(argc, argv);
+    {
+        StartupPhase phase("configuration");
+        parseConfigs();
+        parseArgs(argc, argv);
+    }
+    setLogLevel(config);
 
     if (argc > 1)
     {
@@ -218,6 +944,16 @@ int main(int argc, char **argv)
         writePidFile();
     }
 
+    // After daemonizing, the writer thread wouldn't survive the fork
+    if (logThreshold != INT_MAX && !config.printHelp && !config.printVersion && !config.printStats)
+    {
+        string logFile = logFilePath();
+        if (logFile.empty() || !logWriter.start(logFile))
+        {
+            std::cerr << "Failed to open the log file, logging to stdout." << std::endl;
+        }
+    }
+
     if (config.printHelp)
     {
         std::cout << helpMsg << std::endl;
@@ -230,93 +966,273 @@ int main(int argc, char **argv)
         exit(0);
     }
 
-    int waitedTime = 0;
-    while (!config.ignoreDiscord && !processRunning("vesktop") && !processRunning("discord"))
+    if (config.printStats)
     {
-        log(
-            "Checking processes: discord=" + std::to_string(processRunning("discord")) +
-            ", vesktop=" + std::to_string(processRunning("vesktop")) +
-            ", ignoreDiscord=" + std::to_string(config.ignoreDiscord),
-            LogType::DEBUG
-        );
+        return queryStats();
+    }
+
+    if (!config.replayPath.empty())
+    {
+        return replayTrace(config.replayPath);
+    }
 
-        if (waitedTime > 20)
+    if (config.compileAssets)
+    {
+        string indexPath = assetIndexPath();
+        if (indexPath.empty() || !compileAssetIndex(assetSourcePaths(), indexPath))
         {
-            log(
-                std::string("Neither Discord nor Vesktop is running. Maybe ignore Discord check with --ignore-discord or -f?"),
-                LogType::INFO
-            );
+            std::cerr << "Failed to compile the asset index." << std::endl;
+            exit(1);
         }
-
-        log("Waiting for Discord or Vesktop...", LogType::INFO);
-        waitedTime += 5;
-        sleep(5);
+        std::cout << "Compiled asset index to " << indexPath << std::endl;
+        exit(0);
     }
 
-    disp = XOpenDisplay(NULL);
+    // Before any thread starts, or a SIGTERM could kill one of them instead of reaching the signalfd
+    Reactor::blockSignals({SIGINT, SIGTERM});
+
+    // Only files are involved, so this runs while the main thread waits on X and Discord
+    auto environment = async(launch::async, []()
+                             {
+                                 {
+                                     StartupPhase phase("asset index");
+                                     buildMatchers();
+                                 }
+                                 {
+                                     StartupPhase phase("distro");
+                                     distro = getCachedDistro();
+                                 }
+                                 StartupPhase phase("distro asset");
+                                 distroAsset = getDistroAsset(distro);
+                             });
+
+    if (!config.ignoreDiscord)
+    {
+        StartupPhase phase("wait for Discord");
+        waitForDiscord();
+    }
 
-    if (!disp)
     {
-        std::cout << "Can't open display" << std::endl;
-        return -1;
+        StartupPhase phase("X connection");
+        disp = XOpenDisplay(NULL);
+        xconn = xcb_connect(NULL, NULL);
+
+        if (!disp || xcb_connection_has_error(xconn))
+        {
+            std::cout << "Can't open display" << std::endl;
+            return -1;
+        }
+
+        if (!atoms.intern(xconn))
+        {
+            LOG("Failed to intern some atoms", LogType::WARN);
+        }
     }
 
     static int (*old_error_handler)(Display *, XErrorEvent *);
     trapped_error_code = 0;
     old_error_handler = XSetErrorHandler(error_handler);
 
-    // Compile all regexes
-    compileAllRegexes();
+    {
+        StartupPhase phase("focus tracking");
+        compositor = detectCompositor();
+        if (compositor)
+        {
+            compositor->watchTitle = config.showTitle;
+            compositor->watchPid = config.appUsage;
+            compositor->init();
+            LOG(string("Following focus through ") + compositor->name() + " IPC", LogType::DEBUG);
+        }
+        else
+        {
+            focusWatcher.watchTitle = config.showTitle;
+            focusWatcher.watchPid = config.appUsage;
+            focusWatcher.init(xconn, atoms);
+
+            if (config.idleTimeout > 0 && idleWatcher.init(disp, config.idleTimeout))
+            {
+                idleBackend = &idleWatcher;
+            }
+        }
+
+        if (idleBackend)
+        {
+            idleBackend->onChange = onIdleChange;
+        }
+        else if (config.idleTimeout > 0 && compositor)
+        {
+            // XWayland's idle time only counts input to X windows, so it isn't used here
+            LOG(string("Idle detection isn't available on ") + compositor->name() + ", sampling at full rate", LogType::INFO);
+        }
+    }
+
+    {
+        StartupPhase phase("window manager");
+        startTime = time(0) - ms_uptime();
+        wm = wm_info(xconn, atoms);
+        LOG("WM: " + wm, LogType::DEBUG);
+    }
 
-    pthread_t updateThread;
-    pthread_t usageThread;
-    pthread_create(&usageThread, 0, updateUsage, 0);
-    log("Created usage thread", LogType::DEBUG);
+    {
+        // Failing here isn't fatal anymore, the connection keeps retrying in the background
+        StartupPhase phase("Discord connection");
+        config.nativeIpc ? setupNativeIpc() : setupGameSdk();
+        connection.onReady = onDiscordReady;
+        connection.init(reactor);
+        connection.connect();
+    }
 
-    DiscordState state{};
+    {
+        StartupPhase phase("join environment probes");
+        environment.get();
+        LOG("Distro: " + distro, LogType::DEBUG);
+    }
 
-    discord::Core *core{};
-    auto result = discord::Core::Create(934099338374824007, DiscordCreateFlags_Default, &core); // Change with your own app's ID if you made one
-    state.core.reset(core);
+    if (!config.recordPath.empty())
+    {
+        if (!recorder.open(config.recordPath))
+        {
+            std::cerr << "Failed to open trace " << config.recordPath << std::endl;
+            exit(1);
+        }
+        recorder.meta(startTime, wm, distro);
+    }
+
+    LOG("Xorg version " + std::to_string(XProtocolVersion(disp)), LogType::DEBUG); // This is kinda dumb to do since it shouldn't be anything else other than 11, but whatever
+
+    reactor.addSignals({SIGINT, SIGTERM}, [](int sig)
+                       {
+                           LOG("Received signal " + to_string(sig), LogType::DEBUG);
+                           reactor.stop();
+                       });
 
-    if (!state.core)
+    if (assetWatcher.init(assetSourcePaths()))
     {
-        std::cout << "Failed to instantiate discord core! (err " << static_cast<int>(result) << ")\n";
-        exit(-1);
+        reactor.add(assetWatcher.fd, [](uint32_t)
+                    { reloadAssets(); });
     }
 
-    if (config.debug)
+    reactor.add(sampleTimer, updateUsage);
+    // The presence is rebuilt exactly once per new sample
+    reactor.add(metrics.fd, [](uint32_t)
+                {
+                    metrics.acknowledge();
+                    updateRPC();
+                });
+    reactor.add(publishTimer, []()
+                {
+                    if (publisher.flush(chrono::steady_clock::now()))
+                    {
+                        activitySent();
+                    }
+                    armFlush();
+                });
+
+    if (config.runningApps)
     {
-        state.core->SetLogHook(
-            discord::LogLevel::Debug,
-            [](discord::LogLevel level, const char *message)
-            {
-                std::cerr << "Log(" << static_cast<uint32_t>(level) << "): " << message << "\n";
-            }
-        );
+        StartupPhase phase("process table");
+        processTable.match = [](const string &name, string &asset)
+        { return windowMatcher.match(lower(name), asset) && wantRunningApp(asset); };
+        processTable.onChange = onRunningChange;
+        processTable.init();
+        refreshRunningApps();
+
+        if (processTable.usingEvents())
+        {
+            reactor.add(processTable.fd, [](uint32_t)
+                        { processTable.dispatch(); });
+        }
+        else
+        {
+            reactor.add(processRescanTimer, []()
+                        {
+                            if (processTable.rescan())
+                            {
+                                onRunningChange();
+                            }
+                        });
+            processRescanTimer.start(PROCESS_RESCAN_MS);
+        }
+        LOG("Process table: " + processTable.summary(), LogType::DEBUG);
     }
 
-    pthread_create(&updateThread, 0, updateRPC, ((void *)&state));
-    log("Threads started.", LogType::DEBUG);
-    log("Xorg version " + std::to_string(XProtocolVersion(disp)), LogType::DEBUG); // This is kinda dumb to do since it shouldn't be anything else other than 11, but whatever
-    log("Connected to Discord.", LogType::INFO);
+    statsServer.report = statsReport;
+    if (statsServer.listen(statsSocketPath()))
+    {
+        reactor.add(statsServer.fd, [](uint32_t)
+                    { statsServer.dispatch(); });
+    }
 
-    signal(SIGINT, [](int)
-           { interrupted = true; });
+    if (compositor)
+    {
+        if (!config.noSmallImage)
+        {
+            watchCompositor();
+            reactor.prepareHooks.push_back(watchCompositor);
+            // Nothing is watched while the socket is down, the backoff runs on its own timer
+            reactor.add(compositor->retryTimer, []()
+                        {
+                            string previousClass = compositor->activeClass;
+                            string previousTitle = compositor->activeTitle;
+                            if (compositor->reconnect() &&
+                                (compositor->activeClass != previousClass || (config.showTitle && compositor->activeTitle != previousTitle)))
+                            {
+                                focusChangedNs = Timer::nowNs();
+                                updateRPC();
+                            }
+                            watchCompositor();
+                        });
+        }
+    }
+    else if (!config.noSmallImage)
+    {
+        reactor.add(xcb_get_file_descriptor(xconn), [](uint32_t)
+                    { onXEvents(); });
+        // XCB may have read events into its queue while waiting for a reply, the fd won't tell.
+        // Only that queue is checked here, reading the socket is left to the fd.
+        reactor.prepareHooks.push_back([]()
+                                       { onXEvents(true); });
+    }
+
+    if (idleBackend && idleBackend->fd != -1)
+    {
+        reactor.add(idleBackend->fd, [](uint32_t)
+                    { idleBackend->dispatch(); });
+        reactor.prepareHooks.push_back([]()
+                                       { idleBackend->dispatchQueued(); });
+    }
 
-    do
+    if (idleBackend && idleBackend->polling)
     {
-        state.core->RunCallbacks();
-        std::this_thread::sleep_for(std::chrono::milliseconds(16));
-    } while (!interrupted);
+        reactor.add(idlePollTimer, []()
+                    { idlePollTimer.arm(Timer::nowNs() + idleBackend->poll() * 1000000L); });
+        idlePollTimer.arm(Timer::nowNs() + config.idleTimeout * 1000000L);
+    }
+
+    sampleTimer.start(config.usageSleep);
+
+    // Publishes the first presence through the eventfd as soon as the loop runs
+    {
+        StartupPhase phase("first sample");
+        updateUsage();
+    }
+
+    LOG("Event loop started.", LogType::DEBUG);
+    reactor.run();
 
     std::cout << "Exiting..." << std::endl;
+    recorder.close();
+    statsServer.close();
+    processTable.close();
+    LOG("Sample timer: " + sampleTimer.jitterSummary(), LogType::DEBUG);
+    LOG("Publish timer: " + publishTimer.jitterSummary(), LogType::DEBUG);
+    LOG("Wakeups: " + to_string(reactor.wakeups) + ", activities " + publisher.summary(), LogType::DEBUG);
+    // Last, so the lines above still reach the log file when daemonized
+    logWriter.stop();
 
+    xcb_disconnect(xconn);
     XCloseDisplay(disp);
 
-    pthread_kill(updateThread, 9);
-    pthread_kill(usageThread, 9);
-
     remove(PID_FILE);
 
     return 0;